@@ -20,20 +20,24 @@ def compute_persistence_2DImg_1DHom(f):
 
     # call persistence code to compute diagrams
     # loads PersistencePython.so (compiled from C++); should be in current dir
-    from PersistencePython import cubePers
-    persistence_result = cubePers(np.reshape(
-        f_padded, f_padded.size).tolist(), list(f_padded.shape), 0.001)
+    from PersistencePython import cubePersArrays
+    # the array is read in place (float32/float64, C order), no list is built;
+    # other types (e.g. the boolean ground truth) are converted to float64 first.
+    # the result is a dict of arrays, wrapped by np.asarray without copying
+    dtype = np.float32 if f_padded.dtype == np.float32 else np.float64
+    persistence_result = cubePersArrays(np.ascontiguousarray(f_padded, dtype=dtype),
+        list(f_padded.shape), 0.001, hom_dims=[1])
 
-    # only take 1-dim topology, first column of persistence_result is dimension
-    persistence_result_filtered = np.array(filter(lambda x: x[0] == 1,
-                                                  persistence_result))
+    # only take 1-dim topology
+    keep = np.asarray(persistence_result['dims']) == 1
 
-    # persistence diagram (second and third columns are coordinates)
-    dgm = persistence_result_filtered[:, 1:3]
+    # persistence diagram
+    dgm = np.stack([np.asarray(persistence_result['births'])[keep],
+                    np.asarray(persistence_result['deaths'])[keep]], axis=1)
 
     # critical points
-    birth_cp_list = persistence_result_filtered[:, 4:4 + dim]
-    death_cp_list = persistence_result_filtered[:, 4 + dim:]
+    birth_cp_list = np.asarray(persistence_result['birth_coords'])[keep]
+    death_cp_list = np.asarray(persistence_result['death_coords'])[keep]
 
     # when mapping back, shift critical points back to the original coordinates
     birth_cp_list = birth_cp_list - padwidth
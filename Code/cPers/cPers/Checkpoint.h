@@ -0,0 +1,250 @@
+#ifndef INCLUDED_CHECKPOINT_H
+#define INCLUDED_CHECKPOINT_H
+
+// Checkpoints of a running calcPersistence, so that a long reduction can be resumed.
+// A checkpoint is taken between two columns of the reduction of dimension d and holds
+//  - the sorted vertex list (the cell numbering is a deterministic function of it and is rebuilt),
+//  - the pairs of the dimensions already finished,
+//  - which columns of d were cleared by the pivots of d+1,
+//  - the low array of d and the reduced columns (and recorded additions) before 'next_column'.
+// The remaining columns of d are regenerated from the filtration.
+// The file is written next to the target and renamed over it, so a crash while
+// writing leaves the previous checkpoint intact.
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <stdint.h>
+
+const char kCheckpointMagic[8] = {'P', 'E', 'R', 'S', 'C', 'K', 'P', '1'};
+
+// Decides when to write: at most every 'interval' seconds, and never spending more than
+// 1/kOverheadRatio of the wall time on writing (a slow disk stretches the interval).
+struct CheckpointPolicy
+{
+	static const int kOverheadRatio = 20;
+
+	CheckpointPolicy(double interval_seconds)
+		: interval(interval_seconds), last_write_seconds(0)
+	{
+		last = std::chrono::steady_clock::now();
+	}
+
+	bool due() const
+	{
+		double since = std::chrono::duration<double>(std::chrono::steady_clock::now() - last).count();
+		return since >= interval && since >= kOverheadRatio * last_write_seconds;
+	}
+
+	void written(std::chrono::steady_clock::time_point started)
+	{
+		last = std::chrono::steady_clock::now();
+		last_write_seconds = std::chrono::duration<double>(last - started).count();
+	}
+
+	double interval;
+	double last_write_seconds;
+	std::chrono::steady_clock::time_point last;
+};
+
+// A fingerprint of the input, so that a checkpoint is never applied to another image.
+template<typename NDArray>
+uint64_t inputFingerprint(const NDArray &phi)
+{
+	uint64_t h = 14695981039346656037ULL;
+	for (typename NDArray::const_iterator it = phi.begin(), end = phi.end(); it != end; ++it){
+		double v = *it;
+		const unsigned char *b = reinterpret_cast<const unsigned char *>(&v);
+		for (size_t k = 0; k < sizeof(double); k++)
+			h = (h ^ b[k]) * 1099511628211ULL;
+	}
+	for (int k = 0; k < phi.rank(); k++)
+		h = (h ^ (uint64_t)phi.extent(k)) * 1099511628211ULL;
+	return h;
+}
+
+template<int dim>
+struct PersistenceCheckpoint
+{
+	typedef blitz::TinyVector<int, dim> Vertex;
+	typedef PersPairList<Vertex> PersResultContainer;
+
+	uint64_t fingerprint;
+	unsigned hom_dim_mask;
+	int track;
+
+	vector<Vertex> vList;
+	int d;				// the dimension being reduced
+	int next_column;	// columns before this one are reduced
+	vector<PersResultContainer> results;
+	vector<int> num_pairs;
+	vector<bool> cleared;
+	vector<int> low_array;
+	vector< MatrixListType > columns;
+	vector< MatrixListType > used;
+
+	// The columns and additions are read straight from the stores, nothing is copied.
+	static bool save(const string &path, uint64_t fingerprint, unsigned hom_dim_mask, bool track,
+		const vector<Vertex> &vList, int d, int next_column,
+		const vector<PersResultContainer> &results, const int *num_pairs,
+		const vector<bool> &cleared, const vector<int> &low_array,
+		ColumnStore &columns, ColumnStore *used)
+	{
+		string tmp = path + ".tmp";
+		FILE *f = fopen(tmp.c_str(), "wb");
+		if (!f){
+			OUTPUT_MSG("cannot write checkpoint " << tmp);
+			return false;
+		}
+
+		fwrite(kCheckpointMagic, 1, sizeof(kCheckpointMagic), f);
+		int header[5] = {dim, (int)hom_dim_mask, track ? 1 : 0, d, next_column};
+		fwrite(&fingerprint, sizeof(fingerprint), 1, f);
+		fwrite(header, sizeof(int), 5, f);
+
+		writeSize(f, vList.size());
+		for (size_t i = 0; i < vList.size(); i++)
+			fwrite(vList[i].data(), sizeof(int), dim, f);
+
+		for (int k = 0; k < dim; k++){
+			fwrite(&num_pairs[k], sizeof(int), 1, f);
+			writeSize(f, results[k].size());
+			for (size_t i = 0; i < results[k].size(); i++){
+				const PersResultContainer &r = results[k];
+				fwrite(&r.birth_coords[i * dim], sizeof(int), dim, f);
+				fwrite(&r.death_coords[i * dim], sizeof(int), dim, f);
+				double values[3] = {r.persistence[i], r.birth[i], r.death[i]};
+				fwrite(values, sizeof(double), 3, f);
+			}
+		}
+
+		vector<unsigned char> bits((cleared.size() + 7) / 8, 0);
+		for (size_t i = 0; i < cleared.size(); i++)
+			if (cleared[i])
+				bits[i / 8] |= 1 << (i % 8);
+		writeSize(f, cleared.size());
+		fwrite(bits.data(), 1, bits.size(), f);
+
+		writeSize(f, low_array.size());
+		fwrite(low_array.data(), sizeof(int), low_array.size(), f);
+
+		for (int i = 0; i < next_column; i++){
+			writeList(f, columns[i]);
+			if (track)
+				writeList(f, (*used)[i]);
+		}
+
+		bool ok = fwrite(kCheckpointMagic, 1, sizeof(kCheckpointMagic), f) == sizeof(kCheckpointMagic);
+		ok = (fflush(f) == 0) && ok;
+		ok = (fclose(f) == 0) && ok;
+		if (!ok || rename(tmp.c_str(), path.c_str()) != 0){
+			OUTPUT_MSG("writing checkpoint " << path << " failed");
+			remove(tmp.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	bool load(const string &path)
+	{
+		FILE *f = fopen(path.c_str(), "rb");
+		if (!f)
+			return false;
+
+		bool ok = readMagic(f);
+		int header[5];
+		ok = ok && fread(&fingerprint, sizeof(fingerprint), 1, f) == 1;
+		ok = ok && fread(header, sizeof(int), 5, f) == 5 && header[0] == dim;
+		hom_dim_mask = header[1];
+		track = header[2];
+		d = header[3];
+		next_column = header[4];
+
+		size_t n = ok ? readSize(f) : 0;
+		vList.resize(n);
+		for (size_t i = 0; ok && i < n; i++)
+			ok = fread(vList[i].data(), sizeof(int), dim, f) == dim;
+
+		results.assign(dim, PersResultContainer());
+		num_pairs.assign(dim, 0);
+		for (int k = 0; ok && k < dim; k++){
+			ok = fread(&num_pairs[k], sizeof(int), 1, f) == 1;
+			size_t np = ok ? readSize(f) : 0;
+			results[k].reserve(np);
+			for (size_t i = 0; ok && i < np; i++){
+				Vertex b, e;
+				double values[3];
+				ok = fread(b.data(), sizeof(int), dim, f) == dim
+					&& fread(e.data(), sizeof(int), dim, f) == dim
+					&& fread(values, sizeof(double), 3, f) == 3;
+				if (ok)
+					results[k].append(b, e, values[0], values[1], values[2]);
+			}
+		}
+
+		n = ok ? readSize(f) : 0;
+		vector<unsigned char> bits((n + 7) / 8);
+		ok = ok && fread(bits.data(), 1, bits.size(), f) == bits.size();
+		cleared.assign(n, false);
+		for (size_t i = 0; ok && i < n; i++)
+			cleared[i] = (bits[i / 8] >> (i % 8)) & 1;
+
+		n = ok ? readSize(f) : 0;
+		low_array.resize(n);
+		ok = ok && fread(low_array.data(), sizeof(int), n, f) == n;
+
+		columns.assign(ok ? next_column : 0, MatrixListType());
+		used.assign(ok && track ? next_column : 0, MatrixListType());
+		for (int i = 0; ok && i < next_column; i++){
+			ok = readList(f, columns[i]);
+			if (ok && track)
+				ok = readList(f, used[i]);
+		}
+
+		ok = ok && readMagic(f);
+		fclose(f);
+		if (!ok)
+			OUTPUT_MSG("checkpoint " << path << " is incomplete or corrupt, ignoring it");
+		return ok;
+	}
+
+private:
+	static void writeSize(FILE *f, size_t n)
+	{
+		uint64_t v = n;
+		fwrite(&v, sizeof(v), 1, f);
+	}
+
+	static size_t readSize(FILE *f)
+	{
+		uint64_t v = 0;
+		if (fread(&v, sizeof(v), 1, f) != 1)
+			return 0;
+		return v;
+	}
+
+	static void writeList(FILE *f, const MatrixListType &l)
+	{
+		writeSize(f, l.size());
+		fwrite(l.data(), sizeof(int), l.size(), f);
+	}
+
+	static bool readList(FILE *f, MatrixListType &l)
+	{
+		uint64_t n;
+		if (fread(&n, sizeof(n), 1, f) != 1)
+			return false;
+		l.resize(n);
+		return fread(l.data(), sizeof(int), n, f) == n;
+	}
+
+	static bool readMagic(FILE *f)
+	{
+		char magic[sizeof(kCheckpointMagic)];
+		return fread(magic, 1, sizeof(magic), f) == sizeof(magic)
+			&& memcmp(magic, kCheckpointMagic, sizeof(magic)) == 0;
+	}
+};
+
+#endif
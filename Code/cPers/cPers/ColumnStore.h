@@ -0,0 +1,375 @@
+#ifndef INCLUDED_COLUMN_STORE_H
+#define INCLUDED_COLUMN_STORE_H
+
+// Columns of a sparse matrix (boundary matrix, recorded column additions) under a memory budget.
+// Without a budget this is a plain vector of columns. With one, columns that have not
+// been touched for the longest time are spilled to a memory-mapped scratch file once the
+// resident columns take more than the budget, and are read back on access.
+// Columns are written as their length and zigzag-encoded deltas in LEB128 varints, so a reduced column
+// of nearby cell numbers takes 1-2 bytes per entry instead of 4.
+// A column spilled twice without changing is written only once.
+// The budget covers the column contents, not the per-column bookkeeping (about 40 bytes).
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Debugging.h"
+
+// offset of a column that is not on disk
+const uint64_t kNoColumnOffset = ~(uint64_t)0;
+
+class ColumnStore
+{
+public:
+	ColumnStore()
+		: queue_limit(1024), budget(0), resident_bytes(0), peak_bytes(0), pinned(-1),
+		  fd(-1), map(NULL), map_size(0), file_end(0), mapped_bytes(0),
+		  spills(0), spilled_bytes(0), drops(0), fetches(0), fetched_bytes(0)
+	{}
+
+	~ColumnStore()
+	{
+		closeFile();
+	}
+
+	// 0 keeps everything in memory. The scratch file is created in 'dir' and unlinked
+	// right away, so it disappears with the process.
+	void setBudget(size_t bytes, const string &dir)
+	{
+		budget = bytes;
+		if (budget == 0 || fd >= 0)
+			return;
+
+		string path = dir + "/pers_columns_XXXXXX";
+		vector<char> name(path.begin(), path.end());
+		name.push_back('\0');
+		fd = mkstemp(&name[0]);
+		if (fd < 0){
+			cout << "cannot create spill file in " << dir << ", keeping all columns in memory" << endl;
+			budget = 0;
+			return;
+		}
+		unlink(&name[0]);
+	}
+
+	size_t size() const
+	{
+		return cols.size();
+	}
+
+	// n empty columns
+	void assign(size_t n)
+	{
+		clear();
+		cols.resize(n);
+		if (budget)
+			resetState();
+	}
+
+	// takes over the columns; if they do not fit, the last ones (reduced last) are spilled
+	void adopt(vector< MatrixListType > &columns)
+	{
+		clear();
+		cols.swap(columns);
+		if (!budget)
+			return;
+
+		resetState();
+		for (size_t i = 0; i < cols.size(); i++)
+			resident_bytes += bytesOf(cols[i]);
+		peak_bytes = resident_bytes;
+		for (size_t i = cols.size(); i-- > 0 && resident_bytes > budget; )
+			spill(i);
+		for (size_t i = 0; i < cols.size(); i++)
+			if (!spilled[i] && !cols[i].empty())
+				touch(i);
+	}
+
+	// The reference stays valid until the next access to another column.
+	const MatrixListType &operator[](size_t i)
+	{
+		if (budget && (spilled[i] || (int)i != pinned)){
+			if (spilled[i])
+				fetch(i);
+			touch(i);
+			evict();
+		}
+		return cols[i];
+	}
+
+	void set(size_t i, const MatrixListType &col)
+	{
+		if (!budget){
+			cols[i].assign(col.begin(), col.end());
+			return;
+		}
+		if (!spilled[i])
+			resident_bytes -= bytesOf(cols[i]);
+		MatrixListType(col).swap(cols[i]);
+		spilled[i] = false;
+		offset[i] = kNoColumnOffset;
+		resident_bytes += bytesOf(cols[i]);
+		touch(i);
+		evict();
+	}
+
+	// hands all columns over (reading back the spilled ones) and empties the store
+	void release(vector< MatrixListType > &columns)
+	{
+		if (budget)
+			for (size_t i = 0; i < cols.size(); i++)
+				if (spilled[i])
+					fetch(i);
+		vector< MatrixListType >().swap(columns);
+		columns.swap(cols);
+		clear();
+	}
+
+	void clear()
+	{
+		if (budget && !cols.empty())
+			report();
+		vector< MatrixListType >().swap(cols);
+		vector<uint64_t>().swap(offset);
+		vector<unsigned>().swap(stamp);
+		vector<bool>().swap(spilled);
+		deque< pair<int, unsigned> >().swap(queue);
+		resident_bytes = peak_bytes = 0;
+		pinned = -1;
+		file_end = 0;
+		if (map)
+			madvise(map, map_size, MADV_DONTNEED);
+		mapped_bytes = 0;
+		spills = spilled_bytes = drops = fetches = fetched_bytes = 0;
+	}
+
+private:
+	ColumnStore(const ColumnStore &);
+	ColumnStore &operator=(const ColumnStore &);
+
+	static size_t bytesOf(const MatrixListType &col)
+	{
+		return col.capacity() * sizeof(int);
+	}
+
+	void resetState()
+	{
+		offset.assign(cols.size(), kNoColumnOffset);
+		stamp.assign(cols.size(), 0);
+		spilled.assign(cols.size(), false);
+		queue.clear();
+		queue_limit = 1024;
+		resident_bytes = peak_bytes = 0;
+		pinned = -1;
+	}
+
+	// column i becomes the most recently used one
+	void touch(size_t i)
+	{
+		pinned = i;
+		queue.push_back(make_pair((int)i, ++stamp[i]));
+		if (resident_bytes > peak_bytes)
+			peak_bytes = resident_bytes;
+	}
+
+	// spill the least recently used columns until the budget is met (never the pinned one)
+	void evict()
+	{
+		while (resident_bytes > budget && !queue.empty()){
+			pair<int, unsigned> e = queue.front();
+			if (e.first == pinned && e.second == stamp[e.first])
+				break;
+			queue.pop_front();
+			if (e.second != stamp[e.first] || spilled[e.first])
+				continue;
+			spill(e.first);
+		}
+		// stale entries pile up as columns are touched again or spilled; the limit follows
+		// the live entries, so that a tight budget keeps the queue short
+		if (queue.size() > queue_limit){
+			compactQueue();
+			queue_limit = 2 * queue.size() + 1024;
+		}
+	}
+
+	void compactQueue()
+	{
+		deque< pair<int, unsigned> > live;
+		for (size_t k = 0; k < queue.size(); k++)
+			if (queue[k].second == stamp[queue[k].first] && !spilled[queue[k].first])
+				live.push_back(queue[k]);
+		queue.swap(live);
+	}
+
+	void spill(size_t i)
+	{
+		MatrixListType &col = cols[i];
+		if (offset[i] == kNoColumnOffset){
+			// the length goes first, then the deltas
+			reserveFile(file_end + (col.size() + 1) * 5);
+			unsigned char *out = map + file_end;
+			unsigned char *p = putVarint(out, (uint32_t)col.size());
+			int prev = 0;
+			for (size_t k = 0; k < col.size(); k++){
+				int delta = col[k] - prev;
+				prev = col[k];
+				p = putVarint(p, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+			}
+			offset[i] = file_end;
+			file_end += p - out;
+			spills++;
+			spilled_bytes += p - out;
+			mapped(p - out);
+		}else{
+			// an unchanged copy is already on disk
+			drops++;
+		}
+		resident_bytes -= bytesOf(col);
+		MatrixListType().swap(col);
+		spilled[i] = true;
+	}
+
+	void fetch(size_t i)
+	{
+		MatrixListType &col = cols[i];
+		const unsigned char *in = map + offset[i];
+		uint32_t n;
+		const unsigned char *p = getVarint(in, n);
+		col.resize(n);
+		int prev = 0;
+		for (size_t k = 0; k < col.size(); k++){
+			uint32_t z;
+			p = getVarint(p, z);
+			prev += (int)((z >> 1) ^ (~(z & 1) + 1));
+			col[k] = prev;
+		}
+		spilled[i] = false;
+		resident_bytes += bytesOf(col);
+		fetches++;
+		fetched_bytes += p - in;
+		mapped(p - in);
+	}
+
+	static unsigned char *putVarint(unsigned char *p, uint32_t z)
+	{
+		while (z >= 0x80){
+			*p++ = (unsigned char)(z | 0x80);
+			z >>= 7;
+		}
+		*p++ = (unsigned char)z;
+		return p;
+	}
+
+	static const unsigned char *getVarint(const unsigned char *p, uint32_t &z)
+	{
+		z = 0;
+		int shift = 0;
+		unsigned char b;
+		do {
+			b = *p++;
+			z |= (uint32_t)(b & 0x7f) << shift;
+			shift += 7;
+		} while (b & 0x80);
+		return p;
+	}
+
+	// The pages of the file touched through the mapping count as resident memory of the
+	// process, so they are dropped (the data stays in the file) once about a budget of them
+	// may have been touched. Every access is counted as a whole page.
+	void mapped(size_t bytes)
+	{
+		mapped_bytes += bytes + 512;
+		if (mapped_bytes > budget){
+			madvise(map, map_size, MADV_DONTNEED);
+			mapped_bytes = 0;
+		}
+	}
+
+	void reserveFile(uint64_t needed)
+	{
+		if (needed <= map_size)
+			return;
+		size_t new_size = map_size ? map_size : (1 << 20);
+		while (new_size < needed)
+			new_size *= 2;
+		// the old mapping stays valid until the new one is in place
+		void *m = MAP_FAILED;
+		if (ftruncate(fd, new_size) == 0)
+			m = mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (m == MAP_FAILED)
+			throw std::runtime_error("cannot grow the spill file to " + std::to_string(new_size) + " bytes");
+		if (map)
+			munmap(map, map_size);
+		map = (unsigned char *)m;
+		mapped_bytes = 0;
+		map_size = new_size;
+	}
+
+	void report() const
+	{
+		OUTPUT_MSG("column store: budget " << budget << " B, peak resident " << peak_bytes << " B, "
+			<< spills << " columns spilled (" << spilled_bytes << " B), " << drops << " dropped unchanged, "
+			<< fetches << " fetched (" << fetched_bytes << " B)");
+		if (spills || fetches)
+			DebuggerClass::console() << "column store: peak " << peak_bytes / 1024 << " KB resident, spilled " << spills << " columns / "
+				<< spilled_bytes / 1024 << " KB, fetched " << fetches << " / " << fetched_bytes / 1024 << " KB" << endl;
+	}
+
+	void closeFile()
+	{
+		if (map)
+			munmap(map, map_size);
+		if (fd >= 0)
+			close(fd);
+		map = NULL;
+		fd = -1;
+	}
+
+	vector< MatrixListType > cols;
+	vector<uint64_t> offset;	// where a column was spilled, kNoColumnOffset if it is not on disk
+	vector<unsigned> stamp;		// entries in 'queue' with an older stamp are stale
+	vector<bool> spilled;
+	deque< pair<int, unsigned> > queue;	// least recently used first
+	size_t queue_limit;
+
+	size_t budget, resident_bytes, peak_bytes;
+	int pinned;
+
+	int fd;
+	unsigned char *map;
+	uint64_t map_size, file_end;
+	size_t mapped_bytes;	// touched through the mapping since its pages were last dropped
+
+	size_t spills, spilled_bytes, drops, fetches, fetched_bytes;
+};
+
+// The reduction works on either a plain vector of columns or a ColumnStore.
+inline void resetColumns(vector< MatrixListType > &cols, size_t n)
+{
+	cols.assign(n, MatrixListType());
+}
+
+inline void resetColumns(ColumnStore &cols, size_t n)
+{
+	cols.assign(n);
+}
+
+inline void setColumn(vector< MatrixListType > &cols, size_t i, const MatrixListType &col)
+{
+	cols[i].assign(col.begin(), col.end());
+}
+
+inline void setColumn(ColumnStore &cols, size_t i, const MatrixListType &col)
+{
+	cols.set(i, col);
+}
+
+#endif
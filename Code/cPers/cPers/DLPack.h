@@ -0,0 +1,60 @@
+#ifndef INCLUDED_DLPACK_H
+#define INCLUDED_DLPACK_H
+
+// The parts of the DLPack ABI (https://github.com/dmlc/dlpack, dlpack.h) needed to read
+// and write CPU tensors handed over as "dltensor" capsules, e.g. by
+// torch.utils.dlpack.to_dlpack(t). The layout is fixed by the standard, so the
+// definitions are repeated here instead of adding a dependency.
+// If dlpack.h itself is included first, its definitions are used.
+
+#include <stdint.h>
+
+#ifndef DLPACK_VERSION
+
+typedef enum {
+	kDLCPU = 1,
+	kDLGPU = 2,
+	kDLCPUPinned = 3,
+} DLDeviceType;
+
+typedef struct {
+	DLDeviceType device_type;
+	int device_id;
+} DLContext;
+
+typedef enum {
+	kDLInt = 0U,
+	kDLUInt = 1U,
+	kDLFloat = 2U,
+} DLDataTypeCode;
+
+typedef struct {
+	uint8_t code;
+	uint8_t bits;
+	uint16_t lanes;
+} DLDataType;
+
+typedef struct {
+	void *data;
+	DLContext ctx;
+	int ndim;
+	DLDataType dtype;
+	int64_t *shape;
+	int64_t *strides;		// in elements; NULL for a compact C-ordered tensor
+	uint64_t byte_offset;
+} DLTensor;
+
+typedef struct DLManagedTensor {
+	DLTensor dl_tensor;
+	void *manager_ctx;
+	void (*deleter)(struct DLManagedTensor *self);
+} DLManagedTensor;
+
+#endif
+
+// Capsule names: a consumer renames the capsule once it owns the tensor, and then calls
+// the deleter when it is done with it.
+const char kDLTensorCapsuleName[] = "dltensor";
+const char kDLTensorUsedCapsuleName[] = "used_dltensor";
+
+#endif
@@ -9,18 +9,77 @@ struct InputFileInfo
 
         bool from_python;
 
+	// Whether the reduction lists are recorded, so that representative and
+	// boundary cycles can be saved for the reported pairs.
+	bool track_representatives;
+
+	// Bit k is set if the pairs of homology dimension k are wanted.
+	unsigned hom_dim_mask;
+
+	// Bytes of matrix columns kept in memory per column store, 0 for no limit.
+	// Columns over the budget are spilled to a scratch file in 'spill_dir'.
+	size_t column_budget;
+	string spill_dir;
+
+	// Seconds between checkpoints of the reduction, negative for none.
+	// With 'resume', a valid checkpoint at 'checkpoint_path' is continued.
+	double checkpoint_interval;
+	bool resume;
+	string checkpoint_path;
+
+	// False keeps the whole computation on the calling thread, for callers that
+	// already run many images in parallel.
+	bool allow_pipeline;
+
+	// True lets images with two values be computed from their connected components
+	// (see MaskPersistence.h) instead of by the reduction. Off by default: the pairs are
+	// the same, but their birth and death pixels may be others.
+	bool allow_mask_path;
+
+	// Levels of the coarse to fine computation (see MultiResPersistence.h), 0 for none.
+	int multires_levels;
+
+	bool wantsHomologyDim(int k) const
+	{
+		return (hom_dim_mask >> k) & 1u;
+	}
+
+	bool wantsAllHomologyDims() const
+	{
+		return (hom_dim_mask & ((1u << dimension) - 1)) == (1u << dimension) - 1;
+	}
+
 	explicit InputFileInfo(const int dim )
         {
             from_python = true;
+            track_representatives = false;
+            hom_dim_mask = ~0u;
+            column_budget = 0;
+            spill_dir = ".";
+            checkpoint_interval = -1;
+            resume = false;
+            allow_pipeline = true;
+            allow_mask_path = false;
+            multires_levels = 0;
             dimension = dim;
-	    cout << "dimension: " << dimension << endl;		
+	    DebuggerClass::console() << "dimension: " << dimension << endl;		
         }
 
 	explicit InputFileInfo(const string &input_file)
 	{
                 from_python = false;
+                track_representatives = true;
+                hom_dim_mask = ~0u;
+                column_budget = 0;
+                spill_dir = ".";
+                checkpoint_interval = -1;
+                resume = false;
+                allow_pipeline = true;
+                allow_mask_path = false;
+                multires_levels = 0;
 
 		input_path = input_file;
+		checkpoint_path = input_path + ".ckpt";
 
 		if (input_path.find(".txt") != string::npos || input_path.find(".cub") != string::npos)
 		{
@@ -126,26 +185,18 @@ template<int dim, typename t>
 struct PythonDataReader
 {
 	// template<typename stream_t>
-	void read(const string &file_name, blitz::Array<t, dim> &arr, std::vector<int> dims, std::vector<double> f)
+	void read(const string &file_name, blitz::Array<t, dim> &arr, const std::vector<int> &dims, const std::vector<double> &f)
 	{
-		typedef double ElemT;
 		typedef int HeaderElemT;		
 
 		blitz::TinyVector<HeaderElemT, dim> cnt;
                 for(int i = 0; i < dim; ++i)
                     cnt(i) = (HeaderElemT) dims[i];
 
-
-		blitz::Array<ElemT, dim> a(cnt);	
-
-                int idx = 0;
-                for(typename blitz::Array<ElemT, dim>::iterator myiter = a.begin(); myiter != a.end(); ++myiter){
-                    assert(idx < f.size());
-                    * myiter = f[idx ++];
-                }
-		
+		// f is in C order, like the storage of arr
 		arr.resize(cnt);
-		copy(a.begin(), a.end(), arr.begin());					
+		assert(f.size() >= (size_t)arr.size());
+		copy(f.begin(), f.begin() + arr.size(), arr.begin());					
 //                 if(dim == 3){
 //                 {
 //                 string output_fname = "debug_tmp_3_5.txt";
@@ -194,4 +245,20 @@ struct PythonDataReader
 	}
 };
 
+// Wraps a C-ordered buffer owned by the caller (e.g. a NumPy array) without copying it.
+// The buffer has to outlive arr.
+template<int dim, typename t>
+struct BufferDataReader
+{
+	void read(t *data, blitz::Array<t, dim> &arr, const std::vector<int> &dims)
+	{
+		blitz::TinyVector<int, dim> cnt;
+		for (int i = 0; i < dim; ++i)
+			cnt(i) = dims[i];
+
+		blitz::Array<t, dim> view(data, cnt, blitz::neverDeleteData);
+		arr.reference(view);
+	}
+};
+
 #endif
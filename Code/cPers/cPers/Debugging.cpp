@@ -1,4 +1,5 @@
 #include "Debugging.h"
+#include <mutex>
 
 using namespace std;
 
@@ -9,21 +10,47 @@ bool DebuggerClass::quiet;
 string DebuggerClass::LOG_FNAME;
 string DebuggerClass::ERR_FNAME;
 
+// the pipelined calculator logs from more than one thread
+static std::mutex log_mutex;
+
+// Opened once, in append mode, and kept open: every entry point of the Python module
+// calls init, and truncating the files there wiped the log of a concurrent call.
+static ofstream log_file, err_file;
+
+static void openLog(ofstream &file, string &current, const string &fname, const char *title){
+	if (file.is_open() && current == fname)
+		return;
+	if (file.is_open())
+		file.close();
+	file.clear();
+	file.open(fname.c_str(), ofstream::out | ofstream::app);
+	current = fname;
+	file << title << endl;
+}
+
+static thread_local bool thread_quiet = false;
+// without a buffer every write fails silently
+static ostream null_stream(NULL);
+
+ostream &DebuggerClass::console(){
+	return thread_quiet ? null_stream : cout;
+}
+
+void DebuggerClass::setThreadQuiet(bool qt){
+	thread_quiet = qt;
+}
+
 void DebuggerClass::init ( bool qt, string lfname, string efname ){
+	std::lock_guard<std::mutex> lock(log_mutex);
 	DebuggerClass::quiet = qt;
   	DebuggerClass::num_error = 0;
 	DebuggerClass::LOG_FNAME = lfname;
 	DebuggerClass::ERR_FNAME = efname;
 
-    // initialize the two files, DebuggerClass::LOG and DebuggerClass::ERROR.	    
-        fstream filestr;
-        filestr.open (DebuggerClass::LOG_FNAME.c_str(), fstream::in | fstream::out | fstream::trunc);
-        filestr << "Debuging Persistence Computation -- Log File" << endl;
-        filestr.close();
-
-	filestr.open (DebuggerClass::ERR_FNAME.c_str(), fstream::in | fstream::out | fstream::trunc);
-        filestr << "Debuging Persistence Computation -- Error File" << endl;
-        filestr.close();
+    // open the two files, DebuggerClass::LOG and DebuggerClass::ERROR.
+	static string log_open, err_open;
+	openLog(log_file, log_open, DebuggerClass::LOG_FNAME, "Debuging Persistence Computation -- Log File");
+	openLog(err_file, err_open, DebuggerClass::ERR_FNAME, "Debuging Persistence Computation -- Error File");
 
 	if( ! DebuggerClass::quiet ){
 //	        mexPrintf("log file: %s\n",DebuggerClass::LOG_FNAME);
@@ -40,19 +67,17 @@ void DebuggerClass::init ( bool qt, string lfname, string efname ){
 void DebuggerClass::myMessage (const string msg, bool showtime){
     //      mexWarnMsgTxt(msg.c_str());
     //      mexPrintf("%s\n",msg.c_str());
+ 	    std::lock_guard<std::mutex> lock(log_mutex);
 	    
  	    time_t now;
  	    time(&now);
  
- 	    fstream filestr;
- 	    filestr.open (DebuggerClass::LOG_FNAME.c_str(), fstream::in | fstream::out | fstream::ate);
- 	    
  	    if (showtime){
- 	      filestr << ctime(&now) << "-------" << msg.c_str();
+ 	      log_file << ctime(&now) << "-------" << msg.c_str();
  	    }else{
- 	      filestr << msg.c_str();
+ 	      log_file << msg.c_str();
  	    }
- 	    filestr.close();
+ 	    log_file.flush();
      };
  
 void DebuggerClass::finish(){
@@ -79,20 +104,18 @@ void DebuggerClass::finish(){
 void DebuggerClass::myErrMessage (const string msg,bool showtime){
     //      mexWarnMsgTxt(msg.c_str());
     //      mexPrintf("%s\n",msg.c_str());
+	    std::lock_guard<std::mutex> lock(log_mutex);
     	    DebuggerClass::num_error = DebuggerClass::num_error + 1;
 
 	    time_t now;
 	    time(&now);
 
-	    fstream filestr;
-	    filestr.open (DebuggerClass::ERR_FNAME.c_str(), fstream::in | fstream::out | fstream::ate);
-	    
 	    if (showtime){
-	      filestr << ctime(&now) << "-------" << msg.c_str();
+	      err_file << ctime(&now) << "-------" << msg.c_str();
 	    }else{
-	      filestr << msg.c_str();
+	      err_file << msg.c_str();
 	    }
-	    filestr.close();
+	    err_file.flush();
     };
 
 
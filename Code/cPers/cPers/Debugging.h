@@ -32,6 +32,10 @@ public:
 
     static void myErrMessage (const string ,bool );
 
+    // Where progress is printed: cout, or nowhere on a thread that was made quiet
+    // (the workers of a batch, whose output would only interleave).
+    static ostream &console();
+    static void setThreadQuiet(bool qt);
 };
 
 // OUTPUT_MSG print message (in a stream formation) to log file, together with the time stamp
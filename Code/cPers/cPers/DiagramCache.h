@@ -0,0 +1,418 @@
+#ifndef INCLUDED_DIAGRAM_CACHE_H
+#define INCLUDED_DIAGRAM_CACHE_H
+
+// Persistence diagrams (with their critical points) stored by the content of their input,
+// for images that come back unchanged, e.g. the ground truth patches in every epoch.
+// The key is a 128-bit hash (two XXH64 passes) of the image bytes, its element type, dims,
+// the persistence threshold and the homology dimensions.
+// Diagrams are kept in memory up to a number of bytes, the least recently used going first.
+// Optionally they are also appended to a file that several processes share: each process
+// maps it read-only and indexes the records the others appended since it last looked.
+// Appends are serialized with flock(); the file stops growing at its size limit. A failed
+// append is cut off again, and every record ends with a checksum, so that a record torn by
+// a crashed writer is never read: indexing stops at the first record that fails it.
+
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "PersistentPair.h"
+
+const char kDiagramCacheMagic[8] = {'P', 'D', 'C', 'A', 'C', 'H', 'E', '2'};
+
+// XXH64 (Yann Collet's xxHash, 64-bit variant)
+struct XXHash64
+{
+	static const uint64_t P1 = 11400714785074694791ULL;
+	static const uint64_t P2 = 14029467366897019727ULL;
+	static const uint64_t P3 = 1609587929392839161ULL;
+	static const uint64_t P4 = 9650029242287828579ULL;
+	static const uint64_t P5 = 2870177450012600261ULL;
+
+	static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+	static uint64_t read64(const unsigned char *p) { uint64_t v; memcpy(&v, p, 8); return v; }
+	static uint32_t read32(const unsigned char *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+	static uint64_t round(uint64_t acc, uint64_t v) { return rotl(acc + v * P2, 31) * P1; }
+	static uint64_t merge(uint64_t acc, uint64_t v) { return (acc ^ round(0, v)) * P1 + P4; }
+
+	static uint64_t hash(const void *data, size_t len, uint64_t seed)
+	{
+		const unsigned char *p = static_cast<const unsigned char *>(data);
+		const unsigned char *end = p + len;
+		uint64_t h;
+		if (len >= 32){
+			uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+			for (; p + 32 <= end; p += 32){
+				v1 = round(v1, read64(p));
+				v2 = round(v2, read64(p + 8));
+				v3 = round(v3, read64(p + 16));
+				v4 = round(v4, read64(p + 24));
+			}
+			h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+			h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+		}else{
+			h = seed + P5;
+		}
+		h += len;
+		for (; p + 8 <= end; p += 8)
+			h = rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+		if (p + 4 <= end){
+			h = rotl(h ^ (read32(p) * P1), 23) * P2 + P3;
+			p += 4;
+		}
+		for (; p < end; p++)
+			h = rotl(h ^ (*p * P5), 11) * P1;
+		h ^= h >> 33;
+		h *= P2;
+		h ^= h >> 29;
+		h *= P3;
+		h ^= h >> 32;
+		return h;
+	}
+};
+
+struct DiagramKey
+{
+	uint64_t h[2];
+
+	bool operator==(const DiagramKey &o) const { return h[0] == o.h[0] && h[1] == o.h[1]; }
+};
+
+struct DiagramKeyHash
+{
+	size_t operator()(const DiagramKey &k) const { return k.h[0]; }
+};
+
+// 'type' is the element type ('d' or 'f'), 'data' holds prod(dims) of them.
+inline DiagramKey diagramKey(const void *data, char type, const vector<int> &dims, double pers_thd, unsigned hom_dim_mask)
+{
+	vector<char> params(1 + sizeof(double) + sizeof(unsigned) + dims.size() * sizeof(int));
+	params[0] = type;
+	memcpy(&params[1], &pers_thd, sizeof(double));
+	memcpy(&params[1 + sizeof(double)], &hom_dim_mask, sizeof(unsigned));
+	if (!dims.empty())
+		memcpy(&params[1 + sizeof(double) + sizeof(unsigned)], &dims[0], dims.size() * sizeof(int));
+	size_t n = type == 'd' ? sizeof(double) : sizeof(float);
+	for (size_t i = 0; i < dims.size(); i++)
+		n *= dims[i];
+
+	uint64_t seed = XXHash64::hash(&params[0], params.size(), 0);
+	DiagramKey key;
+	key.h[0] = XXHash64::hash(data, n, seed);
+	key.h[1] = XXHash64::hash(data, n, seed ^ 0x9E3779B97F4A7C15ULL);
+	return key;
+}
+
+inline size_t diagramBytes(const PersDiagramArrays &d)
+{
+	return d.hom_dim.size() * (sizeof(int) + 3 * sizeof(double)) + (d.birth_coords.size() + d.death_coords.size()) * sizeof(int);
+}
+
+// The shared file: a header, then records of
+//   uint32 magic, int32 dim, DiagramKey, uint64 n,
+//   n int32 homology dimensions, n float64 births, deaths, persistence,
+//   n*dim int32 birth and death coordinates, zero padding to 8 bytes,
+//   uint64 XXH64 of the record before it.
+class DiagramCacheFile
+{
+public:
+	static const uint32_t kRecordMagic = 0x52434450;	// "PDCR"
+
+	DiagramCacheFile() : fd(-1), map(NULL), mapped(0), indexed(0), max_bytes(0), broken(false) {}
+
+	~DiagramCacheFile()
+	{
+		if (map)
+			munmap(map, mapped);
+		if (fd >= 0)
+			close(fd);
+	}
+
+	bool open(const string &path, size_t max_file_bytes)
+	{
+		fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+		if (fd < 0){
+			OUTPUT_MSG("cannot open diagram cache file " << path);
+			return false;
+		}
+		max_bytes = max_file_bytes;
+		flock(fd, LOCK_EX);
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size == 0 && write(fd, kDiagramCacheMagic, sizeof(kDiagramCacheMagic)) != sizeof(kDiagramCacheMagic))
+			OUTPUT_MSG("cannot write diagram cache file " << path);
+		flock(fd, LOCK_UN);
+		char magic[sizeof(kDiagramCacheMagic)];
+		if (pread(fd, magic, sizeof(magic), 0) != sizeof(magic) || memcmp(magic, kDiagramCacheMagic, sizeof(magic)) != 0){
+			OUTPUT_MSG("diagram cache file " << path << " is not a cache file, not using it");
+			close(fd);
+			fd = -1;
+			return false;
+		}
+		indexed = sizeof(kDiagramCacheMagic);
+		return true;
+	}
+
+	bool isOpen() const
+	{
+		return fd >= 0;
+	}
+
+	bool find(const DiagramKey &key, PersDiagramArrays &out)
+	{
+		if (fd < 0)
+			return false;
+		std::unordered_map<DiagramKey, size_t, DiagramKeyHash>::iterator it = offsets.find(key);
+		if (it == offsets.end()){
+			refresh();
+			it = offsets.find(key);
+			if (it == offsets.end())
+				return false;
+		}
+		read(it->second, out);
+		return true;
+	}
+
+	void append(const DiagramKey &key, const PersDiagramArrays &d)
+	{
+		if (fd < 0 || broken)
+			return;
+		uint64_t n = d.hom_dim.size();
+		vector<char> rec(recordBytes(n, d.dim), 0);
+		char *p = &rec[0];
+		uint32_t magic = kRecordMagic;
+		int32_t dim = d.dim;
+		put(p, &magic, sizeof(magic));
+		put(p, &dim, sizeof(dim));
+		put(p, key.h, sizeof(key.h));
+		put(p, &n, sizeof(n));
+		putVector(p, d.hom_dim);
+		putVector(p, d.birth);
+		putVector(p, d.death);
+		putVector(p, d.persistence);
+		putVector(p, d.birth_coords);
+		putVector(p, d.death_coords);
+		uint64_t sum = XXHash64::hash(&rec[0], rec.size() - 8, 0);
+		memcpy(&rec[rec.size() - 8], &sum, 8);
+
+		flock(fd, LOCK_EX);
+		struct stat st;
+		if (fstat(fd, &st) == 0 && (max_bytes == 0 || (size_t)st.st_size + rec.size() <= max_bytes))
+			if (pwrite(fd, &rec[0], rec.size(), st.st_size) != (ssize_t)rec.size()){
+				// no part of the record may stay for the next append to complete
+				OUTPUT_MSG("writing to the diagram cache file failed");
+				if (ftruncate(fd, st.st_size) != 0)
+					OUTPUT_MSG("cannot cut the diagram cache file back to " << st.st_size << " bytes");
+			}
+		flock(fd, LOCK_UN);
+	}
+
+private:
+	static size_t recordBytes(uint64_t n, int dim)
+	{
+		size_t b = 8 + sizeof(DiagramKey) + 8 + n * (4 + 3 * 8) + 2 * n * dim * 4;
+		return ((b + 7) & ~(size_t)7) + 8;
+	}
+
+	static void put(char *&p, const void *v, size_t n)
+	{
+		memcpy(p, v, n);
+		p += n;
+	}
+
+	template<typename T>
+	static void putVector(char *&p, const vector<T> &v)
+	{
+		if (!v.empty())
+			put(p, &v[0], v.size() * sizeof(T));
+	}
+
+	template<typename T>
+	static void getVector(const char *&p, vector<T> &v, size_t n)
+	{
+		v.resize(n);
+		if (n)
+			memcpy(&v[0], p, n * sizeof(T));
+		p += n * sizeof(T);
+	}
+
+	// maps the file as it is now and indexes the records appended since the last time;
+	// the shared lock keeps appends out, so every record in the file is complete or torn
+	void refresh()
+	{
+		if (broken)
+			return;
+		flock(fd, LOCK_SH);
+		indexRecords();
+		flock(fd, LOCK_UN);
+	}
+
+	void indexRecords()
+	{
+		struct stat st;
+		if (fstat(fd, &st) != 0 || (size_t)st.st_size <= indexed)
+			return;
+		if (map)
+			munmap(map, mapped);
+		mapped = st.st_size;
+		map = static_cast<char *>(mmap(NULL, mapped, PROT_READ, MAP_SHARED, fd, 0));
+		if (map == MAP_FAILED){
+			map = NULL;
+			mapped = 0;
+			return;
+		}
+		while (indexed < mapped){
+			const char *p = map + indexed;
+			if (indexed + 16 + sizeof(DiagramKey) > mapped){
+				torn();
+				return;
+			}
+			uint32_t magic;
+			int32_t dim;
+			DiagramKey key;
+			uint64_t n;
+			memcpy(&magic, p, 4);
+			memcpy(&dim, p + 4, 4);
+			memcpy(key.h, p + 8, sizeof(key.h));
+			memcpy(&n, p + 8 + sizeof(key.h), 8);
+			if (magic != kRecordMagic || dim < 1 || dim > 8 || n > mapped){
+				torn();
+				return;
+			}
+			size_t bytes = recordBytes(n, dim);
+			uint64_t sum;
+			if (indexed + bytes > mapped
+				|| (memcpy(&sum, p + bytes - 8, 8), sum != XXHash64::hash(p, bytes - 8, 0))){
+				torn();
+				return;
+			}
+			offsets[key] = indexed;
+			indexed += bytes;
+		}
+	}
+
+	// a torn record of a crashed writer; nothing after it can be trusted
+	void torn()
+	{
+		OUTPUT_MSG("diagram cache file is corrupt after byte " << indexed << ", not reading further");
+		broken = true;
+	}
+
+	void read(size_t offset, PersDiagramArrays &out)
+	{
+		const char *p = map + offset + 4;
+		int32_t dim;
+		uint64_t n;
+		memcpy(&dim, p, 4);
+		memcpy(&n, p + 4 + sizeof(DiagramKey), 8);
+		p += 4 + sizeof(DiagramKey) + 8;
+		out.dim = dim;
+		getVector(p, out.hom_dim, n);
+		getVector(p, out.birth, n);
+		getVector(p, out.death, n);
+		getVector(p, out.persistence, n);
+		getVector(p, out.birth_coords, n * dim);
+		getVector(p, out.death_coords, n * dim);
+	}
+
+	int fd;
+	char *map;
+	size_t mapped, indexed, max_bytes;
+	bool broken;
+	std::unordered_map<DiagramKey, size_t, DiagramKeyHash> offsets;
+};
+
+class DiagramCache
+{
+public:
+	// max_bytes: memory for the diagrams kept in this process; 'path' empty for no file.
+	DiagramCache(size_t max_bytes, const string &path = string(), size_t max_file_bytes = 0)
+		: max_bytes(max_bytes), bytes(0), hits(0), file_hits(0), misses(0)
+	{
+		if (!path.empty())
+			file.open(path, max_file_bytes);
+	}
+
+	// Copies the stored diagram into 'out'.
+	bool find(const DiagramKey &key, PersDiagramArrays &out)
+	{
+		std::lock_guard<std::mutex> lock(m);
+		Index::iterator it = index.find(key);
+		if (it != index.end()){
+			lru.splice(lru.begin(), lru, it->second);
+			out = it->second->second;
+			hits++;
+			return true;
+		}
+		if (file.find(key, out)){
+			insertLocked(key, out);
+			file_hits++;
+			return true;
+		}
+		misses++;
+		return false;
+	}
+
+	void insert(const DiagramKey &key, const PersDiagramArrays &d)
+	{
+		std::lock_guard<std::mutex> lock(m);
+		if (index.count(key))
+			return;
+		insertLocked(key, d);
+		file.append(key, d);
+	}
+
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(m);
+		lru.clear();
+		index.clear();
+		bytes = 0;
+	}
+
+	size_t size() { std::lock_guard<std::mutex> lock(m); return index.size(); }
+	size_t memoryBytes() { std::lock_guard<std::mutex> lock(m); return bytes; }
+	size_t hitCount() { std::lock_guard<std::mutex> lock(m); return hits; }
+	size_t fileHitCount() { std::lock_guard<std::mutex> lock(m); return file_hits; }
+	size_t missCount() { std::lock_guard<std::mutex> lock(m); return misses; }
+	bool hasFile() const { return file.isOpen(); }
+
+private:
+	DiagramCache(const DiagramCache &);
+	DiagramCache &operator=(const DiagramCache &);
+
+	typedef std::list< std::pair<DiagramKey, PersDiagramArrays> > LruList;
+	typedef std::unordered_map<DiagramKey, LruList::iterator, DiagramKeyHash> Index;
+
+	void insertLocked(const DiagramKey &key, const PersDiagramArrays &d)
+	{
+		size_t b = diagramBytes(d);
+		if (b > max_bytes)
+			return;
+		lru.push_front(std::make_pair(key, d));
+		index[key] = lru.begin();
+		bytes += b;
+		while (bytes > max_bytes){
+			bytes -= diagramBytes(lru.back().second);
+			index.erase(lru.back().first);
+			lru.pop_back();
+		}
+	}
+
+	size_t max_bytes, bytes;
+	size_t hits, file_hits, misses;
+	LruList lru;
+	Index index;
+	DiagramCacheFile file;
+	std::mutex m;
+};
+
+#endif
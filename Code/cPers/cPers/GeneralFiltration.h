@@ -66,7 +66,8 @@ bool in_bounds(const IndexT &ind, const IndexT &bounds)
 	return true;
 }
 
-template<int dim>
+// ValueT is the type of the image values (double or float).
+template<int dim, typename ValueT = double>
 class CubicalFiltration
 {
 	typedef blitz::TinyVector<int, dim> Vertex;
@@ -94,28 +95,46 @@ class CubicalFiltration
 	const blitz::TinyVector<int, dim> upperBigBounds;
 
 	// The filter function
-	const blitz::Array<double, dim> *const phi;
+	const blitz::Array<ValueT, dim> *const phi;
 
 	// The number of cells in a given dimension.
 	int cellCount[dim+1];
 
+	// After renumberCells: the vertices before 'renumberedFrom' kept their cells, which are
+	// the cells of each dimension numbered before 'firstRenumbered'.
+	int renumberedFrom;
+	int firstRenumbered[dim+1];
+
 	// The index on the filtration list.
 	blitz::Array<int, dim> filtrationOrder;
 
 	// The maximum value of the generic function among all neighbouring vertices.
 	blitz::Array<int, dim> maxValue;
+
+	// 'buffer' itself, resized if needed, or a new array if it is NULL
+	static blitz::Array<int, dim> borrow(blitz::Array<int, dim> *buffer, const blitz::TinyVector<int, dim> &shape)
+	{
+		if (!buffer)
+			return blitz::Array<int, dim>(shape);
+		if (buffer->size() == 0 || blitz::any(buffer->shape() != shape))
+			buffer->resize(shape);
+		return *buffer;
+	}
 public:	
-		  CubicalFiltration(const blitz::Array<double, dim> *const p) :
+		  // The cell arrays may live in buffers kept across filtrations (see PersistenceWorkspace).
+		  CubicalFiltration(const blitz::Array<ValueT, dim> *const p,
+			  blitz::Array<int, dim> *order_buffer = NULL, blitz::Array<int, dim> *max_buffer = NULL) :
 	  phi(p),
 		  lowerOrigBounds(p->lbound()),
 		  upperOrigBounds(p->ubound()),
 		  lowerBigBounds(p->lbound()),
 		  upperBigBounds((2 * p->ubound()) + 1), // this is correct, note that upper bounds are exclusive in blitz!
-		  filtrationOrder(upperBigBounds),
-		  maxValue(upperBigBounds)
+		  filtrationOrder(borrow(order_buffer, upperBigBounds)),
+		  maxValue(borrow(max_buffer, upperBigBounds)),
+		  renumberedFrom(0)
 	  {
 		  fill_n(cellCount, dim+1, 0);
-		  fill_n(maxValue.begin(), getBigTotalSize(), 0);
+		  fill_n(firstRenumbered, dim+1, 0);
 	  }
 
 	  int getSizeInDim(int d)
@@ -124,8 +143,25 @@ public:
 		  return cellCount[d];
 	  }
 
-	  void init(vector< Vertex > * vList)
+	  // The number of every cell within its dimension, on the doubled grid.
+	  const blitz::Array<int, dim> &getFiltrationOrder() const
 	  {
+		  return filtrationOrder;
+	  }
+
+	  // With 'renumber_from' > 0 the buffers hold the numbering of an earlier order of vList
+	  // whose first 'renumber_from' vertices are the same (see WarmStart.h): their cells keep
+	  // their numbers and only the cells touching a later vertex are numbered again.
+	  void init(vector< Vertex > * vList, int renumber_from = 0)
+	  {
+		  if (renumber_from > 0)
+		  {
+			  renumberCells(vList, renumber_from);
+			  return;
+		  }
+
+		  fill_n(maxValue.begin(), getBigTotalSize(), 0);
+
 		  if (vList->empty())
 		  {
 			  constructSortedVertexList(vList);
@@ -143,9 +179,16 @@ public:
 		  int d)
 	  {
 		  assert(!vList->empty());		  
+		  // after renumberCells only the birth vertices of the renumbered cells are written
+		  if (renumberedFrom > 0 && !cell2v_list && list->size() == (size_t)cellCount[d])
+		  {
+			  updateBirthList(*vList, *list, d);
+			  return;
+		  }
 		  list->assign(cellCount[d], -1);		  
-		  cell2v_list->assign(cellCount[d], vector<int>());		  
-		  generateCellLists(*list, *cell2v_list, d);		  
+		  if (cell2v_list)
+			  cell2v_list->assign(cellCount[d], vector<int>());		  
+		  generateCellLists(*list, cell2v_list, d);		  
 	  }
 
 	  // If a given boundary_nD is 0/NULL then it'll not be updated.
@@ -201,6 +244,88 @@ public:
 		  OUTPUT_MSG("---filtration construction finished");
 	  }
 
+	  // The same boundaries, written column by column into a store (see ColumnStore.h),
+	  // so that a store under a column budget never holds the whole matrix at once.
+	  template<typename StoreT>
+	  void streamBoundaries(
+		  vector< Vertex > * vList,
+		  StoreT * boundary,
+		  int d,
+		  const vector<bool> &will_be_cleared)
+	  {
+		  maxValue.free();
+		  resetColumns(*boundary, cellCount[d]);
+
+		  OUTPUT_MSG("start streamed boundary calculation");
+
+		  MatrixListType col;
+		  col.reserve(2*d);
+
+		  for (typename blitz::Array<int, dim>::const_iterator it = filtrationOrder.begin(), end = filtrationOrder.end(); it != end; ++it)
+		  {
+			  Index ind = it.position();
+			  int ourNr = *it;
+
+			  if (dimFromCoords(ind) != d || will_be_cleared[ourNr])
+				  continue;
+
+			  facesOf(ind, col);
+			  setColumn(*boundary, ourNr, col);
+		  }
+
+		  OUTPUT_MSG("---streamed filtration construction finished");
+	  }
+
+	  // The same boundaries once more, built in the order of the cell numbers next to the
+	  // reduction of d+1, which publishes its pivots in 'feed' (see PivotFeed). The columns of
+	  // the cells born at a vertex are built once the columns of d+1 born there are reduced,
+	  // as these clear most of them; a column cleared later is built anyway, and the caller
+	  // drops it. 'birth_list' is the one of dimension d.
+	  template<typename FeedT>
+	  void buildBoundaries(
+		  vector< Vertex > * vList,
+		  const vector<int> &birth_list,
+		  vector< MatrixListType > * boundary,
+		  int d,
+		  FeedT &feed)
+	  {
+		  // columns of an earlier matrix keep their capacity
+		  boundary->resize(cellCount[d]);
+		  for (size_t i = 0; i < boundary->size(); i++)
+			  (*boundary)[i].clear();
+
+		  OUTPUT_MSG("start pipelined boundary calculation");
+
+		  std::vector<Index> deltas;
+		  std::vector<Index> neighbours = delta_generator<dim>::generate(dim);
+		  for (size_t i = 0; i < neighbours.size(); i++)
+			  if (abs_sum(neighbours[i]) == d)
+				  deltas.push_back(neighbours[i]);
+
+		  MatrixListType col;
+		  col.reserve(2*d);
+
+		  for (size_t v = 0; v < vList->size(); v++)
+		  {
+			  feed.waitForVertex(v);
+			  Index index = 2 * vList->at(v);
+			  for (size_t i = 0; i < deltas.size(); i++)
+			  {
+				  Index ind = index + deltas[i];
+				  if (!in_bounds(ind, upperBigBounds))
+					  continue;
+				  int ourNr = filtrationOrder(ind);
+				  if (birth_list[ourNr] != (int)v || feed.cleared(ourNr))
+					  continue;
+
+				  facesOf(ind, col);
+				  (*boundary)[ourNr].assign(col.begin(), col.end());
+			  }
+		  }
+
+		  OUTPUT_MSG("---pipelined filtration construction finished");
+	  }
+
 private:
 	int abs_sum(const Index &delta) const
 	{
@@ -216,17 +341,37 @@ private:
 		return abs_sum(ind % 2);
 	}
 
+	// the boundary column of the cell at 'ind': its faces are one step down or up along
+	// each odd coordinate
+	void facesOf(const Index &ind, MatrixListType &col)
+	{
+		col.clear();
+		for (int k = 0; k < dim; k++)
+		{
+			if (ind[k] % 2 == 0)
+				continue;
+			Index face = ind;
+			face[k]--;
+			col.push_back(filtrationOrder(face));
+			face[k] += 2;
+			col.push_back(filtrationOrder(face));
+		}
+		mysort(col);
+	}
+
 	void resizeBoundary(std::vector<MatrixListType> &boundary, int d, const vector<bool> &willBeCleared)
 	{
 		OUTPUT_MSG("start boundary list resizing");
 
 		int coboundarySize = d*2;
 
+		// columns of an earlier matrix (see PersistenceWorkspace) are emptied, keeping their capacity
 		boundary.resize(cellCount[d]);
-		for (size_t i = 0; i < boundary.size(); i++)
+		for (size_t i = 0; i < boundary.size(); i++){
+			boundary[i].clear();
 			if (!willBeCleared[i])
 				boundary[i].reserve(coboundarySize);
-		else assert(boundary[i].capacity() == 0);
+		}
 
 		OUTPUT_MSG("end boundary list resizing");
 	}
@@ -296,6 +441,94 @@ private:
 		OUTPUT_MSG("end cell numbering ");
 	}
 
+	// assignNumbersToCells for the vertices from 'from' on, the numbering of the others being
+	// that of the previous order. A cell without such a vertex has the same maximal vertex as
+	// before; the others are counted, get their maximum again and are numbered after the rest.
+	void renumberCells(const vector<Vertex> *const vList, int from)
+	{
+		OUTPUT_MSG("start cell renumbering from vertex " << from);
+
+		std::vector<Index> neighbours = delta_generator<dim>::generate(dim);
+		const size_t nsz = neighbours.size();
+
+		int renumbered[dim+1];
+		fill_n(renumbered, dim+1, 0);
+		for (size_t v = from; v < vList->size(); v++)
+		{
+			Index index = 2 * vList->at(v);
+			for (size_t i = 0; i < nsz; i++)
+			{
+				Index newIndex = index + neighbours[i];
+				if (in_bounds(newIndex, upperBigBounds) && maxValue(newIndex) >= 0)
+				{
+					maxValue(newIndex) = -1;
+					renumbered[abs_sum(neighbours[i])]++;
+				}
+			}
+		}
+
+		// the vertices come in increasing order, so the last one written is the maximum
+		for (size_t v = from; v < vList->size(); v++)
+		{
+			Index index = 2 * vList->at(v);
+			for (size_t i = 0; i < nsz; i++)
+			{
+				Index newIndex = index + neighbours[i];
+				if (in_bounds(newIndex, upperBigBounds))
+					maxValue(newIndex) = v;
+			}
+		}
+
+		countCells(cellCount);
+		for (int k = 0; k <= dim; k++)
+			firstRenumbered[k] = cellCount[k] -= renumbered[k];
+		renumberedFrom = from;
+
+		for (size_t v = from; v < vList->size(); v++)
+		{
+			Index index = 2 * vList->at(v);
+			for (size_t i = 0; i < nsz; i++)
+			{
+				Index newIndex = index + neighbours[i];
+				if (in_bounds(newIndex, upperBigBounds) && maxValue(newIndex) == (int)v)
+					filtrationOrder(newIndex) = cellCount[abs_sum(neighbours[i])]++;
+			}
+		}
+		OUTPUT_MSG("end cell renumbering ");
+	}
+
+	// The number of cells of each dimension: a cell of dimension k is odd along k axes.
+	void countCells(int count[dim+1]) const
+	{
+		fill_n(count, dim+1, 0);
+		count[0] = 1;
+		for (int a = 0; a < dim; a++)
+		{
+			int evens = upperOrigBounds[a] + 1;
+			for (int k = a + 1; k >= 0; k--)
+				count[k] = count[k] * evens + (k > 0 ? count[k-1] * (evens - 1) : 0);
+		}
+	}
+
+	// generateCellLists for the cells numbered by renumberCells; the others keep their entries
+	void updateBirthList(const vector<Vertex> &vList, vector<int> &list, int d)
+	{
+		std::vector<Index> neighbours = delta_generator<dim>::generate(dim);
+		const size_t nsz = neighbours.size();
+
+		for (size_t v = renumberedFrom; v < vList.size(); v++)
+		{
+			Index index = 2 * vList[v];
+			for (size_t i = 0; i < nsz; i++)
+			{
+				Index newIndex = index + neighbours[i];
+				if (abs_sum(neighbours[i]) == d && in_bounds(newIndex, upperBigBounds)
+					&& maxValue(newIndex) == (int)v)
+					list[filtrationOrder(newIndex)] = v;
+			}
+		}
+	}
+
 	void constructSortedVertexList(vector<Vertex> *vList)
 	{
 		OUTPUT_MSG("start vList construction and sorting");		
@@ -314,7 +547,7 @@ private:
 
 		// sort vZist accordiYg to fuYctioY vaZues
 		OUTPUT_MSG("start sorting vList by f. value");
-		sort(vList->begin(), vList->end(), PhiComparator<blitz::Array<double,dim> >(this->phi));
+		sort(vList->begin(), vList->end(), PhiComparator<blitz::Array<ValueT,dim> >(this->phi));
 		OUTPUT_MSG("end sorting vList by f. value");
 
 		OUTPUT_MSG("end vList constructed and sorting");
@@ -339,7 +572,8 @@ private:
 		return size;
 	}
 
-	void generateCellLists(vector<int> &list, vector<MatrixListType> &cell2v_list, int d)
+	// 'cell2v_list' may be NULL, then only the birth list is generated.
+	void generateCellLists(vector<int> &list, vector<MatrixListType> *cell2v_list, int d)
 	{
 		OUTPUT_MSG("start explicit cell generation");
 
@@ -366,18 +600,24 @@ private:
 						int order = filtrationOrder(newIndex);						
 						list[order] = maxValue(newIndex);
 
-						cell2v_list[order].push_back( filtrationOrder( ind ) );
+						if (cell2v_list)
+							(*cell2v_list)[order].push_back( filtrationOrder( ind ) );
 					}
 				}
 			}
 		};
 
-		cout << d<< " " <<(int) cell2v_list.size() << endl;
-		for( size_t i = 0; i < cell2v_list.size(); i ++ ){
-			sort( cell2v_list[ i ].begin(), cell2v_list[ i ].end() );
-			MatrixListType::iterator tmpiter = unique(cell2v_list[ i ].begin(), cell2v_list[ i ].end() );
-			cell2v_list[ i ].resize( tmpiter - cell2v_list[ i ].begin() );
-			MY_ASSERT_MORE( cell2v_list[ i ].size() == pow((double)2, d), "ERROR: real size = %d, %d\n ", cell2v_list[ i ].size(), d  );
+		DebuggerClass::console() << d<< " " <<(int) list.size() << endl;
+		if (!cell2v_list){
+			OUTPUT_MSG("end explicit cell generation");
+			return;
+		}
+		for( size_t i = 0; i < cell2v_list->size(); i ++ ){
+			MatrixListType &cell = (*cell2v_list)[ i ];
+			sort( cell.begin(), cell.end() );
+			MatrixListType::iterator tmpiter = unique(cell.begin(), cell.end() );
+			cell.resize( tmpiter - cell.begin() );
+			MY_ASSERT_MORE( cell.size() == pow((double)2, d), "ERROR: real size = %d, %d\n ", cell.size(), d  );
 //			for( size_t j = 0; j < cell2v_list[ i ].size(); j ++ )
 //				cout << cell2v_list[i][j] << " ";
 //			cout << endl;
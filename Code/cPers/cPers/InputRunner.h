@@ -3,6 +3,8 @@
 
 #include "DataReaders.h"
 #include "PersistenceCalcRunner.h"
+#include "WarmStart.h"
+#include "Vineyard.h"
 
 template<int dim>
 struct InputRunner
@@ -26,7 +28,7 @@ struct InputRunner
 		calc.go(&phi, pers_thd, info);
 	}
 
-	static std::vector<std::vector< double > > run( InputFileInfo &info, std::vector<int> dims, const std::vector<double> &f, int pers_thd) 
+	static std::vector<std::vector< double > > run( InputFileInfo &info, std::vector<int> dims, const std::vector<double> &f, double pers_thd) 
 	{		
 		blitz::Array<double, dim> phi;
                 assert(dims.size() == dim);
@@ -38,6 +40,45 @@ struct InputRunner
 		return calc.go_python(&phi, pers_thd, info);
 	}
 
+	// The image is read in place from a C-ordered buffer of float or double.
+	template<typename ValueT>
+	static std::vector<std::vector< double > > run_buffer( InputFileInfo &info, std::vector<int> dims, ValueT *data, double pers_thd) 
+	{		
+		blitz::Array<ValueT, dim> phi;
+                assert(dims.size() == dim);
+		
+		BufferDataReader<dim, ValueT> reader;
+		reader.read(data, phi, dims);
+
+		PersistenceCalcRunner<dim> calc; 
+		return calc.go_python(&phi, pers_thd, info);
+	}
+
+	template<typename ValueT>
+	static void run_arrays( InputFileInfo &info, std::vector<int> dims, ValueT *data, double pers_thd, PersDiagramArrays &out,
+		PersistenceWorkspace<dim> *workspace = NULL, double *robustness = NULL) 
+	{		
+		blitz::Array<ValueT, dim> phi;
+                assert(dims.size() == dim);
+		
+		BufferDataReader<dim, ValueT> reader;
+		reader.read(data, phi, dims);
+
+		PersistenceCalcRunner<dim> calc; 
+		calc.go_python_arrays(&phi, pers_thd, info, out, workspace, robustness);
+	}
+
+	static std::vector<std::vector< double > > run_warm( PersistenceWarmStart &warm, long long id, InputFileInfo &info, std::vector<int> dims, const std::vector<double> &f, double pers_thd) 
+	{		
+		blitz::Array<double, dim> phi;
+                assert(dims.size() == dim);
+		
+		PythonDataReader<dim, double> reader;
+		reader.read(string(), phi, dims, f );
+
+		return warm.compute<dim>(id, phi, pers_thd, info);
+	}
+
 };
 
 
@@ -0,0 +1,227 @@
+#ifndef INCLUDED_MASK_PERSISTENCE_H
+#define INCLUDED_MASK_PERSISTENCE_H
+
+// Persistence of masks: images with two values lo < hi, such as ground truths or thresholded
+// likelihoods. With the pixels as vertices of the cubical complex every finite pair is born at
+// lo and dies at hi, and the pairs are counted by connected components:
+//  - dimension 0: one pair per component of the lo pixels (2*dim neighbours) but one, which
+//    lives forever;
+//  - dimension dim-1: one pair per component of the hi pixels (all 3^dim-1 neighbours) that
+//    does not touch the border, i.e. per hole of the lo pixels (Alexander duality).
+// Components are found by a two-pass labelling, in time linear in the number of pixels.
+// Dimensions in between (1 in 3D, 1 and 2 in 4D) are not counted by components, images that
+// want them take the general way; so do thresholds below 0, for the zero-persistence pairs.
+// The birth and death pixels are representatives: for a component of lo pixels, its first
+// pixel (in C order) and a hi pixel next to it; for a hole, a lo pixel next to it and its
+// first pixel. The general reduction may pick other pixels of the same components.
+
+#include <vector>
+#include <blitz/array.h>
+
+#include "PersistentPair.h"
+#include "DataReaders.h"
+
+template<int dim>
+struct MaskLabeling
+{
+	typedef blitz::TinyVector<int, dim> Vertex;
+
+	Vertex shape;
+	int strides[dim];
+	size_t n;
+
+	// neighbour offsets and their distances in C order
+	vector<Vertex> offsets;
+	vector<long> deltas;
+
+	MaskLabeling(const Vertex &shape, bool full) : shape(shape), n(1)
+	{
+		for (int k = dim - 1; k >= 0; k--){
+			strides[k] = n;
+			n *= shape[k];
+		}
+		int total = 1;
+		for (int k = 0; k < dim; k++)
+			total *= 3;
+		for (int m = 0; m < total; m++){
+			Vertex o;
+			int nonzero = 0;
+			for (int k = 0, r = m; k < dim; k++, r /= 3){
+				o[k] = r % 3 - 1;
+				nonzero += o[k] != 0;
+			}
+			if (nonzero == 0 || (!full && nonzero > 1))
+				continue;
+			long delta = 0;
+			for (int k = 0; k < dim; k++)
+				delta += (long)o[k] * strides[k];
+			offsets.push_back(o);
+			deltas.push_back(delta);
+		}
+	}
+
+	Vertex coords(size_t i) const
+	{
+		Vertex c;
+		for (int k = 0; k < dim; k++){
+			c[k] = i / strides[k];
+			i %= strides[k];
+		}
+		return c;
+	}
+
+	bool inside(const Vertex &c, int j) const
+	{
+		for (int k = 0; k < dim; k++){
+			int x = c[k] + offsets[j][k];
+			if (x < 0 || x >= shape[k])
+				return false;
+		}
+		return true;
+	}
+
+	bool onBorder(const Vertex &c) const
+	{
+		for (int k = 0; k < dim; k++)
+			if (c[k] == 0 || c[k] == shape[k] - 1)
+				return true;
+		return false;
+	}
+
+	static int find(vector<int> &parent, int i)
+	{
+		while (parent[i] != i){
+			parent[i] = parent[parent[i]];
+			i = parent[i];
+		}
+		return i;
+	}
+
+	// parent[i] becomes the root of the component of i among the pixels with mask[i] == value,
+	// the component's first pixel; other pixels get -1.
+	void label(const vector<unsigned char> &mask, unsigned char value, vector<int> &parent) const
+	{
+		parent.assign(n, -1);
+		// first pass: each pixel joins its neighbours visited before it
+		Vertex c(0);
+		for (size_t i = 0; i < n; i++){
+			if (mask[i] == value){
+				parent[i] = i;
+				for (size_t j = 0; j < offsets.size(); j++){
+					if (deltas[j] > 0 || !inside(c, j) || mask[i + deltas[j]] != value)
+						continue;
+					int a = find(parent, i), b = find(parent, i + deltas[j]);
+					if (a < b)
+						parent[b] = a;
+					else if (b < a)
+						parent[a] = b;
+				}
+			}
+			for (int k = dim - 1; k >= 0 && ++c[k] == shape[k]; k--)
+				c[k] = 0;
+		}
+		// second pass: every pixel points at its root
+		for (size_t i = 0; i < n; i++)
+			if (parent[i] >= 0)
+				parent[i] = parent[parent[i]];
+	}
+};
+
+// Fills 'res' (one list per homology dimension) and returns true if 'phi' is a mask this
+// path handles, returns false (with 'res' untouched) otherwise.
+template<int dim, typename ValueT>
+bool maskPersistence(const blitz::Array<ValueT, dim> &phi, double pers_thd, const InputFileInfo &info,
+	vector< PersPairList< blitz::TinyVector<int, dim> > > &res)
+{
+	typedef blitz::TinyVector<int, dim> Vertex;
+
+	if (pers_thd < 0 || phi.size() == 0 || !phi.isStorageContiguous())
+		return false;
+	for (int k = 1; k < dim - 1; k++)
+		if (info.wantsHomologyDim(k))
+			return false;
+	for (int k = dim - 1, s = 1; k >= 0; s *= phi.extent(k), k--)
+		if (phi.stride(k) != s)
+			return false;
+
+	const ValueT *v = phi.data();
+	size_t n = phi.size();
+	ValueT lo = v[0], hi = v[0];
+	bool two = false;
+	if (!(lo == lo))
+		return false;
+	for (size_t i = 1; i < n; i++){
+		if (v[i] == lo || (two && v[i] == hi))
+			continue;
+		if (two || !(v[i] == v[i]))
+			return false;
+		hi = v[i];
+		two = true;
+	}
+	if (hi < lo)
+		std::swap(lo, hi);
+
+	res.assign(dim, PersPairList<Vertex>());
+	double birth = lo, death = hi, pers = death - birth;
+	if (!two || pers <= pers_thd)
+		return true;
+
+	vector<unsigned char> high(n);
+	for (size_t i = 0; i < n; i++)
+		high[i] = v[i] == hi;
+	vector<int> parent, other(n, -1);
+
+	if (info.wantsHomologyDim(0)){
+		MaskLabeling<dim> lab(phi.shape(), false);
+		lab.label(high, 0, parent);
+		// a hi pixel next to each component
+		Vertex c(0);
+		for (size_t i = 0; i < n; i++){
+			if (!high[i] && other[parent[i]] < 0)
+				for (size_t j = 0; j < lab.offsets.size(); j++)
+					if (lab.inside(c, j) && high[i + lab.deltas[j]]){
+						other[parent[i]] = i + lab.deltas[j];
+						break;
+					}
+			for (int k = dim - 1; k >= 0 && ++c[k] == lab.shape[k]; k--)
+				c[k] = 0;
+		}
+		// the component of the first lo pixel lives forever
+		bool first = true;
+		for (size_t i = 0; i < n; i++)
+			if (parent[i] == (int)i){
+				if (!first)
+					res[0].append(lab.coords(i), lab.coords(other[i]), pers, birth, death);
+				first = false;
+			}
+	}
+
+	if (dim > 1 && info.wantsHomologyDim(dim - 1)){
+		MaskLabeling<dim> lab(phi.shape(), true);
+		lab.label(high, 1, parent);
+		// 'other': a lo pixel next to the component, or n if it touches the border
+		other.assign(n, -1);
+		MaskLabeling<dim> axes(phi.shape(), false);
+		Vertex c(0);
+		for (size_t i = 0; i < n; i++){
+			if (high[i] && other[parent[i]] < (int)n){
+				if (lab.onBorder(c))
+					other[parent[i]] = n;
+				else if (other[parent[i]] < 0)
+					for (size_t j = 0; j < axes.offsets.size(); j++)
+						if (!high[i + axes.deltas[j]]){
+							other[parent[i]] = i + axes.deltas[j];
+							break;
+						}
+			}
+			for (int k = dim - 1; k >= 0 && ++c[k] == lab.shape[k]; k--)
+				c[k] = 0;
+		}
+		for (size_t i = 0; i < n; i++)
+			if (parent[i] == (int)i && other[i] < (int)n)
+				res[dim-1].append(lab.coords(other[i]), lab.coords(i), pers, birth, death);
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,152 @@
+// Micro-benchmark for the column merge kernels (MergeKernels.h).
+// The operands are captured from reduceND on a random image (MergeBench [dim] [side]),
+// so the column lengths follow the distribution of a real reduction: the column additions
+// for sym_diff, and for union the operands a pairwise fold would see
+// in the unions that assemble the reduction lists (list_union_gather). Each kernel's
+// checksum hashes the contents of its results and has to match the scalar kernel's.
+#include <cmath>
+#include <vector>
+#include <map>
+#include <set>
+#include <list>
+#include <cassert>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <deque>
+#include <cstring>
+#include <ctime>
+#include <cstdlib>
+#include <chrono>
+#include <blitz/array.h>
+#include <blitz/tinyvec-et.h>
+
+using namespace std;
+
+const int BIG_INT = 0x7FFFFFFF;	//be careful, could be too small compared to # of cubes
+typedef int CellNrType; // it could be long for really large inputs...
+
+// every column addition performed by reduceND is recorded here, and every union
+vector<pair<vector<int>, vector<int> > > captured, captured_unions;
+#define REDUCTION_MERGE_TRACE(a, b) captured.push_back(make_pair(a, b))
+#define LIST_UNION_TRACE(a, b) captured_unions.push_back(make_pair(a, b))
+
+#include "PersistenceIO.h"
+#include "Debugging.h"
+#include "GeneralFiltration.h"
+
+#include "InputRunner.h"
+
+#include "PersistentPair.h"
+#include "DataReaders.h"
+
+#include "PersistenceCalculator.h"
+#include "PersistenceCalcRunner.h"
+
+template<int dim>
+void capture(int side)
+{
+	blitz::TinyVector<int, dim> shape(side);
+	blitz::Array<double, dim> phi(shape);
+	srand(1);
+	for (typename blitz::Array<double, dim>::iterator it = phi.begin(); it != phi.end(); ++it)
+		*it = rand() / (double)RAND_MAX;
+
+	InputFileInfo info(dim);
+	info.track_representatives = true;	// for the unions of the reduction lists
+	PersistenceCalculator<dim> calc;
+	vector<typename PersistenceCalculator<dim>::PersResultContainer> res(dim);
+	vector<blitz::TinyVector<int, dim> > vList;
+	calc.calcPersistence(&phi, 0.0, res, vList, info);
+}
+
+void printDistribution()
+{
+	vector<size_t> lengths;
+	for (size_t i = 0; i < captured.size(); i++)
+		lengths.push_back(captured[i].first.size() + captured[i].second.size());
+	sort(lengths.begin(), lengths.end());
+	cout << "captured " << lengths.size() << " merges, total length percentiles:";
+	int pct[] = {10, 50, 90, 99, 100};
+	for (int i = 0; i < 5; i++)
+		cout << " p" << pct[i] << "=" << lengths[min(lengths.size() - 1, lengths.size() * pct[i] / 100)];
+	cout << endl;
+}
+
+// FNV-1a over the length and the contents of a result
+uint64_t hashResult(uint64_t h, const int *out, size_t n)
+{
+	h = (h ^ n) * 1099511628211ULL;
+	for (size_t i = 0; i < n; i++)
+		h = (h ^ (uint32_t)out[i]) * 1099511628211ULL;
+	return h;
+}
+
+// checksums of the scalar kernels, which the others have to reproduce
+uint64_t expected[2];
+
+// false if a kernel's results differ from the scalar kernel's
+bool timeKernels(const char *isa)
+{
+	MergeKernels k = MergeKernels::select(isa);
+	if (strcmp(k.name, isa) != 0)
+		return true;
+
+	bool ok = true;
+	vector<int> out;
+	const int rounds = 5;
+	const char *ops[] = {"sym_diff", "union"};
+	for (int op = 0; op < 2; op++)
+	{
+		MergeKernelFn fn = op == 0 ? k.sym_diff : k.union_;
+		const vector<pair<vector<int>, vector<int> > > &operands = op == 0 ? captured : captured_unions;
+		if (operands.empty())
+			continue;
+		uint64_t checksum = 14695981039346656037ULL;
+		size_t elems = 0;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (int r = 0; r < rounds; r++)
+			for (size_t i = 0; i < operands.size(); i++)
+			{
+				const vector<int> &a = operands[i].first, &b = operands[i].second;
+				if (out.size() < a.size() + b.size() + kMergeSlack)
+					out.resize(a.size() + b.size() + kMergeSlack);
+				size_t n = fn(a.empty() ? NULL : &a[0], a.size(), b.empty() ? NULL : &b[0], b.size(), &out[0]);
+				if (r == 0)
+					checksum = hashResult(checksum, &out[0], n);
+				elems += a.size() + b.size();
+			}
+		double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+		if (strcmp(isa, "scalar") == 0)
+			expected[op] = checksum;
+		bool same = checksum == expected[op];
+		ok = ok && same;
+		cout << setw(8) << k.name << " " << setw(8) << ops[op] << ": "
+			<< setprecision(3) << ns / elems << " ns/elem, "
+			<< ns / (rounds * operands.size()) << " ns/merge (checksum " << hex << checksum << dec
+			<< (same ? "" : ", DIFFERS from scalar") << ")" << endl;
+	}
+	return ok;
+}
+
+int main(int argc, const char* argv[])
+{
+	int dim = argc > 1 ? atoi(argv[1]) : 2;
+	int side = argc > 2 ? atoi(argv[2]) : (dim == 2 ? 300 : 40);
+
+	DebuggerClass::init( true, "bench_log.txt", "bench_error.txt" );
+
+	if (dim == 3)
+		capture<3>(side);
+	else
+		capture<2>(side);
+
+	printDistribution();
+	cout << "captured " << captured_unions.size() << " unions" << endl;
+	bool ok = timeKernels("scalar");
+	ok = timeKernels("avx2") && ok;
+	ok = timeKernels("avx512") && ok;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,363 @@
+#ifndef MERGE_KERNELS_INCLUDED
+#define MERGE_KERNELS_INCLUDED
+
+// Merge kernels for sorted lists of non-negative cell numbers.
+// Columns of the boundary matrix are such lists, and a column addition over Z2
+// is their symmetric difference. The vector kernels merge both inputs with a
+// bitonic network (8 lanes for AVX2, 16 for AVX-512) and then filter the merged
+// stream: a value present in both inputs appears twice in a row, so the
+// symmetric difference drops both copies and the union drops the second one.
+// The instruction set is chosen once at runtime; PERS_MERGE_KERNEL=scalar|avx2|avx512
+// forces a specific one (e.g. for benchmarking).
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <vector>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MERGE_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+// Output buffers must have this many spare slots past na+nb, vector stores may overrun.
+const size_t kMergeSlack = 16;
+
+// Below this total length the scalar merge is faster than setting up the network.
+const size_t kMergeVectorMin = 32;
+
+typedef size_t (*MergeKernelFn)(const int *a, size_t na, const int *b, size_t nb, int *out);
+
+inline size_t merge_sym_diff_scalar(const int *a, size_t na, const int *b, size_t nb, int *out)
+{
+	return std::set_symmetric_difference(a, a + na, b, b + nb, out) - out;
+}
+
+inline size_t merge_union_scalar(const int *a, size_t na, const int *b, size_t nb, int *out)
+{
+	return std::set_union(a, a + na, b, b + nb, out) - out;
+}
+
+#ifdef MERGE_KERNELS_X86
+
+// Per-thread buffers for the padded inputs and the merged stream.
+struct MergeKernelBuffers
+{
+	std::vector<int> pa, pb, merged;
+
+	static MergeKernelBuffers &local()
+	{
+		static thread_local MergeKernelBuffers buffers;
+		return buffers;
+	}
+};
+
+// Copies 'n' values into 'dst', padded with INT_MAX up to a multiple of 'width'.
+// Returns the padded length. Cell numbers are always smaller than INT_MAX.
+inline size_t merge_pad_input(const int *src, size_t n, size_t width, std::vector<int> &dst)
+{
+	size_t padded = (n + width - 1) / width * width;
+	if (dst.size() < padded)
+		dst.resize(padded);
+	memcpy(&dst[0], src, n * sizeof(int));
+	std::fill(dst.begin() + n, dst.begin() + padded, INT_MAX);
+	return padded;
+}
+
+/**************************** AVX2 ****************************/
+
+// Sorts a bitonic sequence of 8 lanes.
+__attribute__((target("avx2")))
+inline __m256i bitonic_clean_avx2(__m256i v)
+{
+	__m256i t = _mm256_permute2x128_si256(v, v, 0x01);
+	v = _mm256_blend_epi32(_mm256_min_epi32(v, t), _mm256_max_epi32(v, t), 0xF0);
+	t = _mm256_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+	v = _mm256_blend_epi32(_mm256_min_epi32(v, t), _mm256_max_epi32(v, t), 0xCC);
+	t = _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1));
+	v = _mm256_blend_epi32(_mm256_min_epi32(v, t), _mm256_max_epi32(v, t), 0xAA);
+	return v;
+}
+
+// Merges two sorted vectors; 'lo' gets the 8 smallest values, 'hi' the 8 largest, both sorted.
+__attribute__((target("avx2")))
+inline void bitonic_merge_avx2(__m256i a, __m256i b, __m256i &lo, __m256i &hi)
+{
+	const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+	b = _mm256_permutevar8x32_epi32(b, reverse);
+	lo = bitonic_clean_avx2(_mm256_min_epi32(a, b));
+	hi = bitonic_clean_avx2(_mm256_max_epi32(a, b));
+}
+
+// Writes the merged (sorted, with duplicates) stream of a and b to 'merged'.
+// merged[0] is a -1 sentinel, the stream starts at merged[1] and is followed by INT_MAX.
+__attribute__((target("avx2")))
+inline void merge_stream_avx2(const int *a, size_t na, const int *b, size_t nb, std::vector<int> &merged)
+{
+	const size_t W = 8;
+	MergeKernelBuffers &buf = MergeKernelBuffers::local();
+	size_t la = merge_pad_input(a, na, W, buf.pa);
+	size_t lb = merge_pad_input(b, nb, W, buf.pb);
+	const int *pa = &buf.pa[0], *pb = &buf.pb[0];
+
+	if (merged.size() < la + lb + 2 * W)
+		merged.resize(la + lb + 2 * W);
+	int *out = &merged[1];
+	merged[0] = -1;
+
+	__m256i va = _mm256_loadu_si256((const __m256i *)pa);
+	__m256i vb = _mm256_loadu_si256((const __m256i *)pb);
+	size_t ia = W, ib = W;
+	for (;;)
+	{
+		__m256i lo, hi;
+		bitonic_merge_avx2(va, vb, lo, hi);
+		_mm256_storeu_si256((__m256i *)out, lo);
+		out += W;
+		if (ia < la && (ib >= lb || pa[ia] <= pb[ib]))
+		{
+			vb = _mm256_loadu_si256((const __m256i *)(pa + ia));
+			ia += W;
+		}
+		else if (ib < lb)
+		{
+			vb = _mm256_loadu_si256((const __m256i *)(pb + ib));
+			ib += W;
+		}
+		else
+		{
+			_mm256_storeu_si256((__m256i *)out, hi);
+			break;
+		}
+		va = hi;
+	}
+	merged[1 + na + nb] = INT_MAX;
+}
+
+// Permutations moving the lanes selected by an 8-bit mask to the front.
+struct CompressTableAvx2
+{
+	int idx[256][8];
+
+	CompressTableAvx2()
+	{
+		for (int m = 0; m < 256; m++)
+		{
+			int k = 0;
+			for (int lane = 0; lane < 8; lane++)
+				if (m & (1 << lane))
+					idx[m][k++] = lane;
+			while (k < 8)
+				idx[m][k++] = 0;
+		}
+	}
+
+	static const CompressTableAvx2 &get()
+	{
+		static const CompressTableAvx2 table;
+		return table;
+	}
+};
+
+// Keeps merged[i] if it differs from its predecessor and, when 'drop_both'
+// is set, from its successor as well.
+__attribute__((target("avx2")))
+inline size_t merge_filter_avx2(const int *s, size_t n, bool drop_both, int *out)
+{
+	const CompressTableAvx2 &table = CompressTableAvx2::get();
+	size_t o = 0;
+	for (size_t i = 0; i < n; i += 8)
+	{
+		__m256i cur = _mm256_loadu_si256((const __m256i *)(s + i));
+		__m256i prev = _mm256_loadu_si256((const __m256i *)(s + i - 1));
+		__m256i dup = _mm256_cmpeq_epi32(cur, prev);
+		if (drop_both)
+		{
+			__m256i next = _mm256_loadu_si256((const __m256i *)(s + i + 1));
+			dup = _mm256_or_si256(dup, _mm256_cmpeq_epi32(cur, next));
+		}
+		unsigned mask = ~(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(dup)) & 0xFF;
+		if (n - i < 8)
+			mask &= (1u << (n - i)) - 1;
+		__m256i perm = _mm256_loadu_si256((const __m256i *)table.idx[mask]);
+		_mm256_storeu_si256((__m256i *)(out + o), _mm256_permutevar8x32_epi32(cur, perm));
+		o += __builtin_popcount(mask);
+	}
+	return o;
+}
+
+__attribute__((target("avx2")))
+inline size_t merge_sym_diff_avx2(const int *a, size_t na, const int *b, size_t nb, int *out)
+{
+	if (na == 0 || nb == 0 || na + nb < kMergeVectorMin)
+		return merge_sym_diff_scalar(a, na, b, nb, out);
+	std::vector<int> &merged = MergeKernelBuffers::local().merged;
+	merge_stream_avx2(a, na, b, nb, merged);
+	return merge_filter_avx2(&merged[1], na + nb, true, out);
+}
+
+__attribute__((target("avx2")))
+inline size_t merge_union_avx2(const int *a, size_t na, const int *b, size_t nb, int *out)
+{
+	if (na == 0 || nb == 0 || na + nb < kMergeVectorMin)
+		return merge_union_scalar(a, na, b, nb, out);
+	std::vector<int> &merged = MergeKernelBuffers::local().merged;
+	merge_stream_avx2(a, na, b, nb, merged);
+	return merge_filter_avx2(&merged[1], na + nb, false, out);
+}
+
+/**************************** AVX-512 ****************************/
+
+// Sorts a bitonic sequence of 16 lanes.
+__attribute__((target("avx512f")))
+inline __m512i bitonic_clean_avx512(__m512i v)
+{
+	__m512i t = _mm512_shuffle_i32x4(v, v, _MM_SHUFFLE(1, 0, 3, 2));
+	v = _mm512_mask_blend_epi32(0xFF00, _mm512_min_epi32(v, t), _mm512_max_epi32(v, t));
+	t = _mm512_shuffle_i32x4(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+	v = _mm512_mask_blend_epi32(0xF0F0, _mm512_min_epi32(v, t), _mm512_max_epi32(v, t));
+	t = _mm512_shuffle_epi32(v, (_MM_PERM_ENUM)_MM_SHUFFLE(1, 0, 3, 2));
+	v = _mm512_mask_blend_epi32(0xCCCC, _mm512_min_epi32(v, t), _mm512_max_epi32(v, t));
+	t = _mm512_shuffle_epi32(v, (_MM_PERM_ENUM)_MM_SHUFFLE(2, 3, 0, 1));
+	v = _mm512_mask_blend_epi32(0xAAAA, _mm512_min_epi32(v, t), _mm512_max_epi32(v, t));
+	return v;
+}
+
+__attribute__((target("avx512f")))
+inline void bitonic_merge_avx512(__m512i a, __m512i b, __m512i &lo, __m512i &hi)
+{
+	const __m512i reverse = _mm512_setr_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+	b = _mm512_permutexvar_epi32(reverse, b);
+	lo = bitonic_clean_avx512(_mm512_min_epi32(a, b));
+	hi = bitonic_clean_avx512(_mm512_max_epi32(a, b));
+}
+
+__attribute__((target("avx512f")))
+inline void merge_stream_avx512(const int *a, size_t na, const int *b, size_t nb, std::vector<int> &merged)
+{
+	const size_t W = 16;
+	MergeKernelBuffers &buf = MergeKernelBuffers::local();
+	size_t la = merge_pad_input(a, na, W, buf.pa);
+	size_t lb = merge_pad_input(b, nb, W, buf.pb);
+	const int *pa = &buf.pa[0], *pb = &buf.pb[0];
+
+	if (merged.size() < la + lb + 2 * W)
+		merged.resize(la + lb + 2 * W);
+	int *out = &merged[1];
+	merged[0] = -1;
+
+	__m512i va = _mm512_loadu_si512(pa);
+	__m512i vb = _mm512_loadu_si512(pb);
+	size_t ia = W, ib = W;
+	for (;;)
+	{
+		__m512i lo, hi;
+		bitonic_merge_avx512(va, vb, lo, hi);
+		_mm512_storeu_si512(out, lo);
+		out += W;
+		if (ia < la && (ib >= lb || pa[ia] <= pb[ib]))
+		{
+			vb = _mm512_loadu_si512(pa + ia);
+			ia += W;
+		}
+		else if (ib < lb)
+		{
+			vb = _mm512_loadu_si512(pb + ib);
+			ib += W;
+		}
+		else
+		{
+			_mm512_storeu_si512(out, hi);
+			break;
+		}
+		va = hi;
+	}
+	merged[1 + na + nb] = INT_MAX;
+}
+
+__attribute__((target("avx512f")))
+inline size_t merge_filter_avx512(const int *s, size_t n, bool drop_both, int *out)
+{
+	size_t o = 0;
+	for (size_t i = 0; i < n; i += 16)
+	{
+		__m512i cur = _mm512_loadu_si512(s + i);
+		__mmask16 dup = _mm512_cmpeq_epi32_mask(cur, _mm512_loadu_si512(s + i - 1));
+		if (drop_both)
+			dup |= _mm512_cmpeq_epi32_mask(cur, _mm512_loadu_si512(s + i + 1));
+		__mmask16 keep = ~dup;
+		if (n - i < 16)
+			keep &= (1u << (n - i)) - 1;
+		_mm512_mask_compressstoreu_epi32(out + o, keep, cur);
+		o += __builtin_popcount(keep);
+	}
+	return o;
+}
+
+__attribute__((target("avx512f")))
+inline size_t merge_sym_diff_avx512(const int *a, size_t na, const int *b, size_t nb, int *out)
+{
+	if (na == 0 || nb == 0 || na + nb < kMergeVectorMin)
+		return merge_sym_diff_scalar(a, na, b, nb, out);
+	std::vector<int> &merged = MergeKernelBuffers::local().merged;
+	merge_stream_avx512(a, na, b, nb, merged);
+	return merge_filter_avx512(&merged[1], na + nb, true, out);
+}
+
+__attribute__((target("avx512f")))
+inline size_t merge_union_avx512(const int *a, size_t na, const int *b, size_t nb, int *out)
+{
+	if (na == 0 || nb == 0 || na + nb < kMergeVectorMin)
+		return merge_union_scalar(a, na, b, nb, out);
+	std::vector<int> &merged = MergeKernelBuffers::local().merged;
+	merge_stream_avx512(a, na, b, nb, merged);
+	return merge_filter_avx512(&merged[1], na + nb, false, out);
+}
+
+#endif // MERGE_KERNELS_X86
+
+// The kernels selected for this machine.
+struct MergeKernels
+{
+	const char *name;
+	MergeKernelFn sym_diff;
+	MergeKernelFn union_;
+
+	static MergeKernels scalar()
+	{
+		MergeKernels k = { "scalar", merge_sym_diff_scalar, merge_union_scalar };
+		return k;
+	}
+
+	// Returns the kernels for the given instruction set, or the scalar ones if the
+	// CPU does not support it.
+	static MergeKernels select(const char *isa)
+	{
+#ifdef MERGE_KERNELS_X86
+		__builtin_cpu_init();
+		bool want512 = isa == NULL || strcmp(isa, "avx512") == 0;
+		bool want2 = want512 || strcmp(isa, "avx2") == 0;
+		if (want512 && __builtin_cpu_supports("avx512f"))
+		{
+			MergeKernels k = { "avx512", merge_sym_diff_avx512, merge_union_avx512 };
+			return k;
+		}
+		if (want2 && __builtin_cpu_supports("avx2"))
+		{
+			MergeKernels k = { "avx2", merge_sym_diff_avx2, merge_union_avx2 };
+			return k;
+		}
+#endif
+		return scalar();
+	}
+
+	static const MergeKernels &get()
+	{
+		static const MergeKernels kernels = select(getenv("PERS_MERGE_KERNEL"));
+		return kernels;
+	}
+};
+
+#endif
@@ -0,0 +1,427 @@
+#ifndef INCLUDED_MULTI_RES_PERSISTENCE_H
+#define INCLUDED_MULTI_RES_PERSISTENCE_H
+
+// Coarse to fine persistence of large images, for dimension 0 (components) and dim-1 (holes).
+// A pyramid of block minima and maxima is built (MinMaxPyramid); the diagram of the minima
+// of the coarsest level gives the candidate components, the one of the maxima the candidate
+// holes. The exact pairs are then computed at full resolution, on the pixels of the region
+// of each candidate only:
+//  - a component born at block B and dying at d: the blocks connected to B through blocks
+//    whose minimum is at most T, for T = d first. The sublevel sets up to T are the same
+//    there as in the whole image, so a pair of the region dying by T is a pair of the image;
+//    a pair dying later gets a second region, with T its death, where it is exact.
+//  - a hole with highest pixel q, born at b: the blocks connected to q's block (fully)
+//    through blocks whose maximum is above T, for T = b first, and one pixel around them.
+//    The pair of the region is the image's if the pixels above its birth connected to q stay
+//    off the sides of the region, and if those at its birth hold a pixel above q or touch the
+//    border of the image; the latter are looked for in the whole image, as a side of the
+//    region may have stood in for the older component. Otherwise the next region is taken
+//    with T its birth, or is the box of the pixels at its birth if they are the ones lacking.
+// Pooling keeps the values of minima and maxima, and only lengthens pairs: the pair of a
+// candidate is at least as persistent at full resolution. It merges components, though,
+// whose ridge is thinner than a block. The guarantee: every pair returned is a pair of the
+// image (up to the choice among equal values), and a pair of persistence above pers_thd is
+// missed only if
+//  - for a component born at p and dying at d, p is not below every other pixel of the
+//    blocks reachable from its block through blocks of minimum below d;
+//  - for a hole born at b with highest pixel q, q is not above every other pixel of the
+//    blocks reachable from its block through blocks of maximum above b, or these blocks
+//    touch the border of the image.
+// Once the regions of all rounds cover together as many pixels as the image, the candidates
+// left are computed on the whole image, so no more than twice its pixels are computed;
+// components dying at the level of a background that spans the image get no cheaper.
+
+#include <map>
+#include <limits>
+#include <blitz/array.h>
+
+#include "PersistentPair.h"
+#include "PersistenceCalculator.h"
+#include "MaskPersistence.h"
+
+// Level k holds the minima and maxima of the blocks of 2^k x ... x 2^k pixels; level 0 is
+// the image itself and is not copied.
+template<int dim, typename ValueT>
+struct MinMaxPyramid
+{
+	typedef blitz::TinyVector<int, dim> Vertex;
+
+	vector< blitz::Array<ValueT, dim> > lo, hi;
+
+	// At most 'levels' levels above the image; a level is only added while every axis
+	// longer than one pixel keeps at least two blocks.
+	MinMaxPyramid(const blitz::Array<ValueT, dim> &image, int levels)
+	{
+		lo.push_back(image);
+		hi.push_back(image);
+		while ((int)lo.size() <= levels){
+			const blitz::Array<ValueT, dim> &l = lo.back();
+			bool fits = false;
+			for (int k = 0; k < dim; k++){
+				if (l.extent(k) == 2)
+					return;
+				fits = fits || l.extent(k) > 2;
+			}
+			if (!fits)
+				return;
+			lo.push_back(blitz::Array<ValueT, dim>());
+			hi.push_back(blitz::Array<ValueT, dim>());
+			pool(lo[lo.size()-2], hi[hi.size()-2], lo.back(), hi.back());
+		}
+	}
+
+	int levels() const
+	{
+		return lo.size() - 1;
+	}
+
+	// Blocks of two pixels along each axis, the last one cut at odd extents: the minimum
+	// and maximum of the 2^dim strided views.
+	static void pool(const blitz::Array<ValueT, dim> &lo_in, const blitz::Array<ValueT, dim> &hi_in,
+		blitz::Array<ValueT, dim> &lo, blitz::Array<ValueT, dim> &hi)
+	{
+		Vertex extent = (lo_in.shape() + 1) / 2;
+		lo.resize(extent);
+		hi.resize(extent);
+		const Vertex two(2);
+		for (int m = 0; m < (1 << dim); m++){
+			Vertex first, sub;
+			bool empty = false;
+			for (int k = 0; k < dim; k++){
+				first[k] = lo_in.lbound(k) + ((m >> k) & 1);
+				sub[k] = (lo_in.extent(k) - ((m >> k) & 1) + 1) / 2;
+				empty = empty || sub[k] == 0;
+			}
+			if (empty)
+				continue;
+			blitz::StridedDomain<dim> from(first, first + 2 * (sub - 1), two);
+			if (m == 0){
+				lo = lo_in(from);
+				hi = hi_in(from);
+				continue;
+			}
+			blitz::RectDomain<dim> to(lo.lbound(), lo.lbound() + sub - 1);
+			lo(to) = blitz::min(lo(to), lo_in(from));
+			hi(to) = blitz::max(hi(to), hi_in(from));
+		}
+	}
+};
+
+template<int dim, typename ValueT>
+class MultiResPersistence
+{
+public:
+	typedef blitz::TinyVector<int, dim> Vertex;
+	typedef PersPairList<Vertex> PersResultContainer;
+
+	MultiResPersistence(const blitz::Array<ValueT, dim> &phi, int levels, double pers_thd, const InputFileInfo &info)
+		: phi(phi), pyramid(phi, levels), pers_thd(pers_thd), info(info)
+	{
+		block = 1 << pyramid.levels();
+		num_pixels = phi.size();
+		flood = 0;
+	}
+
+	bool usable() const
+	{
+		return pyramid.levels() > 0;
+	}
+
+	// The pairs of dimension 0 and dim-1 wanted by 'info' into 'res'.
+	void compute(vector<PersResultContainer> &res)
+	{
+		res.assign(dim, PersResultContainer());
+		if (info.wantsHomologyDim(0))
+			resolve(0, res[0]);
+		if (dim > 1 && info.wantsHomologyDim(dim - 1))
+			resolve(dim - 1, res[dim-1]);
+	}
+
+private:
+	// A coarse pair: the block of its birth (dimension 0) or death (holes), the value there,
+	// and the level of the region it is computed on, or the box of the region if 'boxed'.
+	struct Candidate
+	{
+		size_t block;
+		double value;
+		double level;
+		bool boxed;
+		Vertex lb, ub;
+	};
+
+	// The diagram of dimension k of 'image'.
+	void diagram(blitz::Array<ValueT, dim> &image, int k, PersResultContainer &out) const
+	{
+		InputFileInfo sub(info);
+		sub.hom_dim_mask = 1u << k;
+		sub.track_representatives = false;
+		sub.checkpoint_interval = -1;
+		sub.resume = false;
+		vector<PersResultContainer> res(dim);
+		if (!(sub.allow_mask_path && maskPersistence(image, pers_thd, sub, res))){
+			PersistenceCalculator<dim, ValueT> calc;
+			vector<Vertex> vList;
+			calc.calcPersistence(&image, pers_thd, res, vList, sub);
+		}
+		out.swap(res[k]);
+	}
+
+	// The box of the pixels of the blocks connected to the candidate's block through blocks
+	// of minimum at most (dimension 0) or of maximum above (holes) its level, and of the
+	// pixels around them.
+	void regionBox(const MaskLabeling<dim> &lab, const ValueT *values, bool low, const Candidate &c,
+		vector<size_t> &stamp, size_t id, Vertex &lb, Vertex &ub) const
+	{
+		vector<size_t> stack(1, c.block);
+		stamp[c.block] = id;
+		lb = ub = lab.coords(c.block);
+		while (!stack.empty()){
+			size_t i = stack.back();
+			stack.pop_back();
+			Vertex v = lab.coords(i);
+			for (int k = 0; k < dim; k++){
+				lb[k] = std::min(lb[k], v[k]);
+				ub[k] = std::max(ub[k], v[k]);
+			}
+			for (size_t j = 0; j < lab.offsets.size(); j++){
+				if (!lab.inside(v, j))
+					continue;
+				size_t nb = i + lab.deltas[j];
+				if (stamp[nb] != id && (low ? values[nb] <= c.level : values[nb] > c.level)){
+					stamp[nb] = id;
+					stack.push_back(nb);
+				}
+			}
+		}
+		for (int k = 0; k < dim; k++){
+			lb[k] = std::max(lb[k] * block - 1, 0);
+			ub[k] = std::min((ub[k] + 1) * block, phi.extent(k) - 1);
+		}
+	}
+
+	// Whether the pixels above 'level' connected to 'start' (fully) reach a side of 'crop',
+	// at 'lb' in the image, that is not a side of the image.
+	bool leaks(const blitz::Array<ValueT, dim> &crop, const Vertex &lb, const Vertex &start, double level) const
+	{
+		MaskLabeling<dim> lab(crop.shape(), true);
+		const ValueT *values = crop.data();
+		size_t s = 0;
+		for (int k = 0; k < dim; k++)
+			s += start[k] * lab.strides[k];
+		vector<char> seen(lab.n, 0);
+		vector<size_t> stack(1, s);
+		seen[s] = 1;
+		while (!stack.empty()){
+			size_t i = stack.back();
+			stack.pop_back();
+			Vertex v = lab.coords(i);
+			for (int k = 0; k < dim; k++)
+				if ((v[k] == 0 && lb[k] > 0) || (v[k] == crop.extent(k) - 1 && lb[k] + v[k] < phi.extent(k) - 1))
+					return true;
+			for (size_t j = 0; j < lab.offsets.size(); j++){
+				if (!lab.inside(v, j))
+					continue;
+				size_t nb = i + lab.deltas[j];
+				if (!seen[nb] && values[nb] > level){
+					seen[nb] = 1;
+					stack.push_back(nb);
+				}
+			}
+		}
+		return false;
+	}
+
+	// Whether the pixels at or above 'level' connected to 'start' in the image (fully) hold
+	// a pixel above 'start' or touch the border: the hole dying at 'start' merges into them
+	// at 'level', and they are older. Stops at the first such pixel; if there is none, 'lb'
+	// and 'ub' bound the pixels and the one around them.
+	bool mergesOlder(const Vertex &start, double level, Vertex &lb, Vertex &ub)
+	{
+		MaskLabeling<dim> lab(phi.shape(), true);
+		if (seen.empty())
+			seen.assign(lab.n, 0);
+		size_t s = 0;
+		for (int k = 0; k < dim; k++)
+			s += start[k] * lab.strides[k];
+		const double top = phi(Vertex(start + phi.lbound()));
+		vector<size_t> stack(1, s);
+		seen[s] = ++flood;
+		lb = ub = start;
+		while (!stack.empty()){
+			size_t i = stack.back();
+			stack.pop_back();
+			Vertex v = lab.coords(i);
+			if (phi(Vertex(v + phi.lbound())) > top || lab.onBorder(v))
+				return true;
+			for (int k = 0; k < dim; k++){
+				lb[k] = std::min(lb[k], v[k] - 1);
+				ub[k] = std::max(ub[k], v[k] + 1);
+			}
+			for (size_t j = 0; j < lab.offsets.size(); j++){
+				if (!lab.inside(v, j))
+					continue;
+				size_t nb = i + lab.deltas[j];
+				if (seen[nb] != flood && phi(Vertex(lab.coords(nb) + phi.lbound())) >= level){
+					seen[nb] = flood;
+					stack.push_back(nb);
+				}
+			}
+		}
+		return false;
+	}
+
+	void resolve(int k, PersResultContainer &out)
+	{
+		const bool low = k == 0;
+		blitz::Array<ValueT, dim> &level = low ? pyramid.lo.back() : pyramid.hi.back();
+		MaskLabeling<dim> lab(level.shape(), !low);
+
+		vector<Candidate> pending;
+		{
+			blitz::Array<ValueT, dim> coarse_image(level.shape());
+			coarse_image = level;
+			PersResultContainer coarse;
+			diagram(coarse_image, k, coarse);
+			for (size_t i = 0; i < coarse.size(); i++){
+				Vertex v = low ? coarse.birthV(i) : coarse.deathV(i);
+				Candidate c;
+				c.block = 0;
+				for (int a = 0; a < dim; a++)
+					c.block += v[a] * lab.strides[a];
+				c.value = low ? coarse.birth[i] : coarse.death[i];
+				c.level = low ? coarse.death[i] : coarse.birth[i];
+				c.boxed = false;
+				pending.push_back(c);
+			}
+		}
+
+		vector<size_t> stamp(lab.n, 0);
+		size_t id = 0;
+		size_t spent = 0;	// pixels of the regions of the rounds before
+		while (!pending.empty()){
+			typedef std::map< vector<int>, vector<size_t> > Regions;
+			Regions regions;
+			size_t covered = 0;
+			for (size_t i = 0; i < pending.size(); i++){
+				Vertex lb = pending[i].lb, ub = pending[i].ub;
+				if (!pending[i].boxed)
+					regionBox(lab, level.data(), low, pending[i], stamp, ++id, lb, ub);
+				vector<int> key(lb.begin(), lb.end());
+				key.insert(key.end(), ub.begin(), ub.end());
+				vector<size_t> &r = regions[key];
+				if (r.empty()){
+					size_t pixels = 1;
+					for (int a = 0; a < dim; a++)
+						pixels *= ub[a] - lb[a] + 1;
+					covered += pixels;
+				}
+				r.push_back(i);
+			}
+			// the regions so far as large as the image: the whole image, where every pair
+			// is exact
+			const bool whole = spent + covered >= num_pixels;
+			spent += covered;
+			if (whole){
+				vector<int> key(dim, 0);
+				for (int a = 0; a < dim; a++)
+					key.push_back(phi.extent(a) - 1);
+				regions.clear();
+				for (size_t i = 0; i < pending.size(); i++)
+					regions[key].push_back(i);
+			}
+
+			vector<Candidate> next;
+			for (typename Regions::const_iterator it = regions.begin(); it != regions.end(); ++it){
+				Vertex lb, ub;
+				for (int a = 0; a < dim; a++){
+					lb[a] = it->first[a];
+					ub[a] = it->first[dim + a];
+				}
+				blitz::Array<ValueT, dim> crop(ub - lb + 1);
+				crop = phi(blitz::RectDomain<dim>(lb + phi.lbound(), ub + phi.lbound()));
+				PersResultContainer pairs;
+				diagram(crop, k, pairs);
+				for (size_t j = 0; j < it->second.size(); j++){
+					Candidate c = pending[it->second[j]];
+					int p = findPair(pairs, lab, c, low, lb);
+					// none if an equal value elsewhere took the pair
+					if (p < 0)
+						continue;
+					bool exact = whole;
+					c.boxed = false;
+					if (!exact && low)
+						exact = pairs.death[p] <= c.level;
+					else if (!exact && !leaks(crop, lb, pairs.deathV(p), pairs.birth[p])){
+						// the pair is the region's up to its birth: below it, the box of
+						// the pixels it merges into
+						c.boxed = !mergesOlder(Vertex(pairs.deathV(p) + lb), pairs.birth[p], c.lb, c.ub);
+						exact = !c.boxed;
+					}
+					if (exact){
+						out.append(pairs.birthV(p) + lb, pairs.deathV(p) + lb, pairs.persistence[p], pairs.birth[p], pairs.death[p]);
+						continue;
+					}
+					c.level = low ? pairs.death[p] : pairs.birth[p];
+					for (int a = 0; c.boxed && a < dim; a++){
+						c.lb[a] = std::max(c.lb[a], 0);
+						c.ub[a] = std::min(c.ub[a], phi.extent(a) - 1);
+					}
+					next.push_back(c);
+				}
+			}
+			pending.swap(next);
+		}
+	}
+
+	// The pair of the region born (dimension 0) or dying (holes) in the candidate's block at
+	// its value: the most persistent one if several pixels of the block have that value.
+	int findPair(const PersResultContainer &pairs, const MaskLabeling<dim> &lab, const Candidate &c, bool low, const Vertex &lb) const
+	{
+		Vertex b = lab.coords(c.block);
+		int found = -1;
+		for (size_t i = 0; i < pairs.size(); i++){
+			if ((low ? pairs.birth[i] : pairs.death[i]) != c.value)
+				continue;
+			Vertex v = (low ? pairs.birthV(i) : pairs.deathV(i)) + lb;
+			bool inside = true;
+			for (int a = 0; a < dim; a++)
+				inside = inside && v[a] / block == b[a];
+			if (inside && (found < 0 || pairs.persistence[i] > pairs.persistence[found]))
+				found = i;
+		}
+		return found;
+	}
+
+	const blitz::Array<ValueT, dim> &phi;
+	MinMaxPyramid<dim, ValueT> pyramid;
+	double pers_thd;
+	const InputFileInfo &info;
+	int block;
+	size_t num_pixels;
+	vector<size_t> seen;	// of mergesOlder, the number of the last flood reaching each pixel
+	size_t flood;
+};
+
+// Fills 'res' (one list per homology dimension) from the pyramid of info.multires_levels
+// levels and returns true, or returns false (with 'res' untouched) if 'phi' is too small for
+// a level, has NaNs, or dimensions other than 0 and dim-1 are wanted.
+template<int dim, typename ValueT>
+bool multiResPersistence(const blitz::Array<ValueT, dim> &phi, double pers_thd, const InputFileInfo &info,
+	vector< PersPairList< blitz::TinyVector<int, dim> > > &res)
+{
+	if (info.multires_levels < 1 || phi.size() == 0)
+		return false;
+	for (int k = 1; k < dim - 1; k++)
+		if (info.wantsHomologyDim(k))
+			return false;
+	if (blitz::any(phi != phi))
+		return false;
+
+	MultiResPersistence<dim, ValueT> multires(phi, info.multires_levels, pers_thd, info);
+	if (!multires.usable())
+		return false;
+	multires.compute(res);
+	return true;
+}
+
+#endif
@@ -3,26 +3,24 @@
 
 #include "PersistentPair.h"
 #include "PersistenceCalculator.h"
+#include "MaskPersistence.h"
+#include "MultiResPersistence.h"
 
 template<int dim>
 struct PersistenceCalcRunner
 {
 	typedef blitz::TinyVector<int, dim> Vertex; 
-	typedef vector<PersPair<Vertex> > PersResultContainer;	
+	typedef PersPairList<Vertex> PersResultContainer;	
 
 	void go(blitz::Array<double, dim> *phi, double pers_thd, const InputFileInfo &info)
 	{	
 		// int max_pers_pts = BIG_INT; // the maximal number of persistence pairs recorded								
 
-//		blitz::Array<double, dim> persistenceM(phi->ubound()+1); 
-
 		PersistenceCalculator<dim> calc;
 		vector<PersResultContainer> res(dim);		
 
 		vector< Vertex > vList;
-		calc.calcPersistence(phi, pers_thd,
-			//&persistenceM, 
-			res, vList, info);		
+		calc.calcPersistence(phi, pers_thd, res, vList, info);		
 
 		{
 
@@ -54,37 +52,107 @@ struct PersistenceCalcRunner
 		}
 	}
 
-        std::vector<std::vector< double > > go_python(blitz::Array<double, dim> *phi, double pers_thd,  const InputFileInfo &info )
-	{	
-		// int max_pers_pts = BIG_INT; // the maximal number of persistence pairs recorded								
-
-//		blitz::Array<double, dim> persistenceM(phi->ubound()+1); 
-
-		PersistenceCalculator<dim> calc;
-		vector<PersResultContainer> res(dim);		
-
-		vector< Vertex > vList;
-		calc.calcPersistence(phi, pers_thd,
-			//&persistenceM, 
-			res, vList, info);		
+	// One row per pair: dimension, birth, death, persistence, birth vertex, death vertex.
+	static std::vector<std::vector< double > > toRows(const vector<PersResultContainer> &res, double pers_thd = -1)
+	{
                 int ct = 0;
                 for(int d = 0; d < dim; ++d)
-                    ct += res[d].size();
+                    for(int i = 0; i < res[d].size(); ++i)
+                        ct += res[d].persistence[i] > pers_thd;
                 std::vector<std::vector< double > > ret(ct, std::vector<double>( 2*dim + 4 ) );
                 int idx = 0;
                 for(int d = 0; d < dim; ++d){
                 for(int i = 0; i < res[d].size(); ++i){
+                    if (res[d].persistence[i] <= pers_thd)
+                        continue;
                     ret[idx][0] = d;
-                    ret[idx][1] = res[d][i].birth;
-                    ret[idx][2] = res[d][i].death;
-                    ret[idx][3] = res[d][i].persistence;
+                    ret[idx][1] = res[d].birth[i];
+                    ret[idx][2] = res[d].death[i];
+                    ret[idx][3] = res[d].persistence[i];
                     for(int k = 0; k < dim; ++k){
-                       ret[idx][4+k] = res[d][i].birthV(k); 
-                       ret[idx][4+dim+k] = res[d][i].deathV(k); 
+                       ret[idx][4+k] = res[d].birth_coords[i*dim + k]; 
+                       ret[idx][4+dim+k] = res[d].death_coords[i*dim + k]; 
                     }
                     idx++;
                 }
                 }
+                return ret;
+	}
+
+	// The same pairs as toRows, column by column. 'res' is emptied.
+	static void toArrays(vector<PersResultContainer> &res, double pers_thd, PersDiagramArrays &out)
+	{
+		out.dim = dim;
+		for (int d = 0; d < dim; ++d){
+			PersResultContainer &r = res[d];
+			for (size_t i = 0; i < r.size(); ++i){
+				if (r.persistence[i] <= pers_thd)
+					continue;
+				out.hom_dim.push_back(d);
+				out.birth.push_back(r.birth[i]);
+				out.death.push_back(r.death[i]);
+				out.persistence.push_back(r.persistence[i]);
+				out.birth_coords.insert(out.birth_coords.end(), r.birth_coords.begin() + i*dim, r.birth_coords.begin() + (i+1)*dim);
+				out.death_coords.insert(out.death_coords.end(), r.death_coords.begin() + i*dim, r.death_coords.begin() + (i+1)*dim);
+			}
+			r.clear();
+		}
+	}
+
+	// Adds the persistence of each pair of 'res' at its birth and death vertex, for the pairs
+	// that do not come from calcPersistence, which does so as it saves them.
+	static void addRobustness(const vector<PersResultContainer> &res, blitz::Array<double, dim> &persRobM)
+	{
+		for (int d = 0; d < dim; ++d)
+			for (size_t i = 0; i < res[d].size(); ++i){
+				Vertex b, e;
+				for (int k = 0; k < dim; ++k){
+					b[k] = res[d].birth_coords[i*dim + k];
+					e[k] = res[d].death_coords[i*dim + k];
+				}
+				persRobM(b) += res[d].persistence[i];
+				persRobM(e) += res[d].persistence[i];
+			}
+	}
+
+	// Same as go_python, with the pairs returned as arrays. The buffers of the computation
+	// come from 'workspace' if it is not NULL. If 'robustness' is not NULL, it receives the
+	// robustness map: the image's number of values, in C order, each the sum of the
+	// persistence of the pairs above pers_thd born or dying at that vertex.
+	template<typename ValueT>
+	void go_python_arrays(blitz::Array<ValueT, dim> *phi, double pers_thd, const InputFileInfo &info, PersDiagramArrays &out,
+		PersistenceWorkspace<dim> *workspace = NULL, double *robustness = NULL)
+	{
+		PersistenceCalculator<dim, ValueT> calc;
+		vector<PersResultContainer> res(dim);
+		vector< Vertex > local_vList;
+		vector< Vertex > &vList = workspace ? workspace->vList : local_vList;
+		vList.clear();
+		blitz::Array<double, dim> persRobM;
+		if (robustness){
+			blitz::Array<double, dim> view(robustness, phi->shape(), blitz::neverDeleteData);
+			persRobM.reference(view);
+			persRobM = 0;
+		}
+		if (!(info.allow_mask_path && maskPersistence(*phi, pers_thd, info, res)) && !multiResPersistence(*phi, pers_thd, info, res))
+			calc.calcPersistence(phi, pers_thd, res, vList, info, NULL, workspace, robustness ? &persRobM : NULL);
+		else if (robustness)
+			addRobustness(res, persRobM);
+		toArrays(res, pers_thd, out);
+	}
+
+        template<typename ValueT>
+        std::vector<std::vector< double > > go_python(blitz::Array<ValueT, dim> *phi, double pers_thd,  const InputFileInfo &info )
+	{	
+		// int max_pers_pts = BIG_INT; // the maximal number of persistence pairs recorded								
+
+		PersistenceCalculator<dim, ValueT> calc;
+		vector<PersResultContainer> res(dim);		
+
+		vector< Vertex > vList;
+		if (!(info.allow_mask_path && maskPersistence(*phi, pers_thd, info, res)) && !multiResPersistence(*phi, pers_thd, info, res))
+			calc.calcPersistence(phi, pers_thd, res, vList, info);		
+                std::vector<std::vector< double > > ret = toRows(res);
 
 //                 string output_fname = "debug_persistence.txt";
 // 	        fstream output_filestr(output_fname, fstream::out | fstream::trunc);
@@ -6,15 +6,60 @@
 // to be cleared, and clear them once we have calculated the matrix.
 // We need to store only one matrix at a time.
 
+#include <thread>
+#include <functional>
+#include <exception>
+
 #include "Reduction.h"
+#include "Checkpoint.h"
+#include "PersistenceWorkspace.h"
+
+// Joins a thread when it goes out of scope, so that an exception thrown next to a running
+// thread does not destroy it joinable (which would terminate the process). A thread
+// waiting for the pivots in 'feed' is released first.
+struct ThreadJoiner
+{
+	std::thread &thread;
+	PivotFeed *feed;
+
+	explicit ThreadJoiner(std::thread &t, PivotFeed *f = NULL) : thread(t), feed(f) {}
+
+	~ThreadJoiner()
+	{
+		if (feed)
+			feed->finish();
+		if (thread.joinable())
+			thread.join();
+	}
+
+	// joins now, and raises what the thread stored in 'error'
+	void join(std::exception_ptr &error)
+	{
+		if (feed)
+			feed->finish();
+		if (thread.joinable())
+			thread.join();
+		if (error){
+			std::exception_ptr e = error;
+			error = std::exception_ptr();
+			std::rethrow_exception(e);
+		}
+	}
+};
 
 // By switching FiltrationGeneratorType it should be possible to use for example simplicial complexes
-template<int dim, typename FiltrationGeneratorType = CubicalFiltration<dim> >
+// ValueT is the type of the image values; the pairs are reported as doubles either way.
+template<int dim, typename ValueT = double, typename FiltrationGeneratorType = CubicalFiltration<dim, ValueT> >
 struct PersistenceCalculator {	
 
 	typedef blitz::TinyVector<int, dim> Vertex;
-	typedef vector<PersPair<Vertex> > PersResultContainer;
+	typedef blitz::Array<ValueT, dim> ValueArray;
+	typedef PersPairList<Vertex> PersResultContainer;
 
+	// If 'used_columns' is NULL, only the pairs are saved; otherwise the reduction
+	// and boundary lists are rebuilt for the pairs above pers_thd.
+	// If 'persRobM' is not NULL, the persistence of each saved pair is added at its birth
+	// and at its death vertex.
 	template<typename NDArray>
 	void SavePersistence(
 		NDArray * phi,
@@ -25,12 +70,12 @@ struct PersistenceCalculator {
 		vector< CellNrType > & upperCellList, 
 		const double pers_thd, 									 
 		PersResultContainer &veList, 
-		//NDArray &persRobM,
+		blitz::Array<double, dim> *persRobM,
 		/* for reduction list*/
-		vector< MatrixListType > & red_list,
+		ColumnStore * used_columns,
 		vector< MatrixListType > & red_cell2v_list,
 		vector< MatrixListType > & final_red_list,
-		vector< MatrixListType > & bd_list,
+		ColumnStore & bd_list,
 		vector< MatrixListType > & bd_cell2v_list,
 		vector< MatrixListType > & final_boundary_list
 		) 
@@ -38,13 +83,8 @@ struct PersistenceCalculator {
 		assert( final_red_list.empty() );
 		assert( final_boundary_list.empty() );
 
-//                 cout << " What is going on? " << endl;
-//                 for (int i = 0; i < 10; ++i){
-//                     for(int j = 0; j < 10; ++j)
-//                         cout << (*phi)(i,j) << " ";
-//                     cout << endl;
-//                 }
-// 
+		// columns of the reported pairs, in the order of veList
+		vector< int > reported;
 
 		// output vertex-edge pairs whose persistence is bigger than pers_thd
 		for (size_t i=0;i<lowerCellList.size();i++){
@@ -65,55 +105,187 @@ struct PersistenceCalculator {
 
 			if (tmp_pers > pers_thd){				
 				//write persistence pair into veList
-				veList.push_back(PersPair<Vertex>(vList[vBirth],
-					vList[vDeath],tmp_pers,tmp_birth, tmp_death));				
+				veList.append(vList[vBirth],
+					vList[vDeath],tmp_pers,tmp_birth, tmp_death);				
 
 // 				cout << "BIRTH: " << vList[vBirth]+1 << " -- " << tmp_birth<< endl;
 // 				cout << "DEATH: " << vList[vDeath]+1 << " -- " << tmp_death << endl;
-// 
-//				persRobM(vList[vBirth])+=tmp_pers;
-//				persRobM(vList[vDeath])-=tmp_pers;				
-				
-				//save the reduction lists
-				MatrixListType tmp_list;
-				MY_ASSERT( ! red_list[ tmp_int ].empty() );
-				for( MatrixListType::iterator tmpiter = red_list[ tmp_int ].begin(); tmpiter != red_list[ tmp_int ].end(); tmpiter ++ ){
-					tmp_list = list_union( tmp_list, red_cell2v_list[ * tmpiter ] );
-				}
-				final_red_list.push_back( tmp_list );
-//				cout << "red list: ";
-//				for( MatrixListType::iterator tmpiter = red_list[tmp_int].begin(); tmpiter != red_list[tmp_int].end(); tmpiter ++ )
-//					cout << red_cell2v_list[* tmpiter][0] << " " << red_cell2v_list[* tmpiter][red_cell2v_list[* tmpiter].size()-1] << " | ";
-//				cout << endl;
-
-//				for( MatrixListType::iterator tmpitit = tmp_list.begin(); tmpitit != tmp_list.end(); tmpitit ++ )
-//				{
-//					cout << vList[ *tmpitit] + 1 << "--" << (*phi)(vList[ *tmpitit]) << endl;
-//				}	
-
-				//save the boundary lists
-				MatrixListType tmp_boundary_list;
-				MY_ASSERT( ! bd_list[ tmp_int ].empty() );
-				for( MatrixListType::iterator tmpiter = bd_list[ tmp_int ].begin(); tmpiter != bd_list[ tmp_int ].end(); tmpiter ++ ){
-	//				if( tmp_boundary_list.empty() )
-	//					tmp_boundary_list = bd_cell2v_list[ * tmpiter ];
-	//				else 
-						tmp_boundary_list = list_union( tmp_boundary_list, bd_cell2v_list[ * tmpiter ] );
-				}
-				final_boundary_list.push_back( tmp_boundary_list );
-//				cout << "bd list: ";
-//				for( MatrixListType::iterator tmpiter = bd_list[tmp_int].begin(); tmpiter != bd_list[tmp_int].end(); tmpiter ++ )
-//					cout << bd_cell2v_list[* tmpiter][0] << " " << bd_cell2v_list[* tmpiter][bd_cell2v_list[* tmpiter].size()-1] << " | " ;
-//				cout << endl;
 
+				if (persRobM){
+					(*persRobM)(vList[vBirth])+=tmp_pers;
+					(*persRobM)(vList[vDeath])+=tmp_pers;
+				}
 
+				reported.push_back( tmp_int );
 			}		
 		}		
+
+		if( ! used_columns )
+			return;
+
+		vector< MatrixListType > red_list;
+		reconstructReductionLists( * used_columns, reported, red_list );
+
+		for (size_t k = 0; k < reported.size(); k++){
+			int tmp_int = reported[k];
+
+			//save the reduction lists
+			MatrixListType tmp_list;
+			MY_ASSERT( ! red_list[ tmp_int ].empty() );
+			list_union_gather( red_list[ tmp_int ], red_cell2v_list, vList.size(), tmp_list );
+			final_red_list.push_back( tmp_list );
+
+			//save the boundary lists
+			MatrixListType tmp_boundary_list;
+			MY_ASSERT( ! bd_list[ tmp_int ].empty() );
+			list_union_gather( bd_list[ tmp_int ], bd_cell2v_list, vList.size(), tmp_boundary_list );
+			final_boundary_list.push_back( tmp_boundary_list );
+		}
+	}
+
+	// Saves the pairs of homology dimension d-1 (and, if tracked, the .red/.bnd files),
+	// then frees what the reduction of dimension d left behind.
+	// It may run on its own thread: it touches only the lists of dimensions d and d-1.
+	void exportDimension( ValueArray * phi, const double pers_thd, int d, bool track_d,
+		vector<Vertex> &vList, vector<vector<int> > &birth_lists, vector<vector<int> > &low_arrays,
+		int &count_pairs, PersResultContainer &veList, ColumnStore &used_columns,
+		vector< vector< MatrixListType > > &cell2v_lists, ColumnStore &boundary, const InputFileInfo &info, WarmReduction *warm,
+		PersistenceWorkspace<dim> *workspace, blitz::Array<double, dim> *persRobM)
+	{
+		vector< MatrixListType > final_reduction_list;
+		vector< MatrixListType > final_boundary_list;
+
+		SavePersistence(phi, vList, birth_lists[d-1], low_arrays[d], count_pairs, birth_lists[d], pers_thd, veList, 
+			persRobM,
+			track_d ? &used_columns : NULL, cell2v_lists[d], final_reduction_list, boundary, cell2v_lists[d-1], final_boundary_list);
+
+		if( track_d && !info.from_python ){
+			BinaryPersistentPairsSaver<dim> binSaver;
+			stringstream output_red_file;
+			output_red_file << info.input_path;
+			output_red_file << ".red." << d;
+			binSaver.saveOneDimReduction(final_reduction_list, vList, output_red_file.str().c_str(), d);		
+			stringstream output_boundary_file;
+			output_boundary_file << info.input_path;
+			output_boundary_file << ".bnd." << d;
+			binSaver.saveOneDimReduction(final_boundary_list, vList, output_boundary_file.str().c_str(), d);	
+		}
+
+		DebuggerClass::console() << "saved dimension " << d << endl;
+
+		if (warm)
+			recordPivots(warm->pivots[d-1], birth_lists[d-1], low_arrays[d], birth_lists[d]);
+
+		used_columns.clear();
+		releaseBoundary(boundary, d, warm, workspace);
 	}
 
-	double calcPersistence( blitz::Array<double, dim> * phi, const double pers_thd, 
-		// blitz::Array<double, dim> * const persRobM, 
-		vector<PersResultContainer> &result_lists, vector<Vertex> & _vList, const InputFileInfo &info)
+	// the reduced matrix is freed, kept for the next warm-started computation, or its
+	// columns go back to the workspace
+	static void releaseBoundary(ColumnStore &boundary, int d, WarmReduction *warm, PersistenceWorkspace<dim> *workspace)
+	{
+		if (warm && warm->keep)
+			boundary.release(warm->reduced[d]);
+		else if (workspace)
+			boundary.release(workspace->columns[d]);
+		else
+			boundary.clear();
+	}
+
+	// the pairs of low_array as vertex ranks, for the next warm-started computation
+	static void recordPivots(vector< pair<int, int> > &pivots, const vector<int> &lowerCellList,
+		const vector<int> &low_array, const vector<int> &upperCellList)
+	{
+		pivots.clear();
+		for (size_t i = 0; i < low_array.size(); i++){
+			if (low_array[i] == BIG_INT)
+				continue;
+			int vBirth = lowerCellList[i], vDeath = upperCellList[low_array[i]];
+			if (vBirth != vDeath)
+				pivots.push_back(make_pair(vBirth, vDeath));
+		}
+	}
+
+	// Puts the columns of the previous computation in front of the new boundary matrix of d,
+	// as far as their cells are numbered the same, and returns where the reduction continues.
+	static size_t reuseWarmColumns(WarmReduction *warm, int d, vector< MatrixListType > &built,
+		const vector<int> &birth_list, vector<int> &low_array)
+	{
+		if (!warm || warm->prefix_vertices <= 0 || warm->reduced[d].size() != built.size())
+			return 0;
+
+		// cells are numbered in the order of their maximal vertex, which 'birth_list' holds
+		size_t prefix = lower_bound(birth_list.begin(), birth_list.end(), warm->prefix_vertices) - birth_list.begin();
+		for (size_t i = 0; i < prefix; i++){
+			built[i].swap(warm->reduced[d][i]);
+			if (!built[i].empty())
+				low_array[built[i].back()] = i;
+		}
+		myclear(warm->reduced[d]);
+		return prefix;
+	}
+
+	// Takes the periodic checkpoints while one dimension is reduced.
+	struct CheckpointHook : ReductionObserver
+	{
+		CheckpointHook(const InputFileInfo &info, uint64_t fp, const vector<Vertex> &vl,
+			const vector<PersResultContainer> &res, const int *np, std::thread &exp)
+			: policy(info.checkpoint_interval), path(info.checkpoint_path), fingerprint(fp), mask(info.hom_dim_mask),
+			  vList(vl), results(res), num_pairs(np), exporter(exp),
+			  d(0), track_d(false), low_array(NULL), columns(NULL), used(NULL)
+		{}
+
+		void columnsReduced(size_t next_column)
+		{
+			if (!policy.due())
+				return;
+			std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+			// the pairs of d+1 have to be complete
+			if (exporter.joinable())
+				exporter.join();
+			if (PersistenceCheckpoint<dim>::save(path, fingerprint, mask, track_d, vList, d, next_column,
+					results, num_pairs, cleared, *low_array, *columns, track_d ? used : NULL))
+				OUTPUT_MSG("checkpoint at dimension " << d << ", column " << next_column);
+			policy.written(started);
+		}
+
+		CheckpointPolicy policy;
+		string path;
+		uint64_t fingerprint;
+		unsigned mask;
+		const vector<Vertex> &vList;
+		const vector<PersResultContainer> &results;
+		const int *num_pairs;
+		std::thread &exporter;
+
+		// the dimension being reduced
+		int d;
+		bool track_d;
+		vector<bool> cleared;	// columns of d cleared by the pivots of d+1
+		vector<int> *low_array;
+		ColumnStore *columns, *used;
+	};
+
+	// PERS_PIPELINE=0|1 overrides the default, which is to pipeline on multi-core machines only
+	static bool usePipeline(const InputFileInfo &info)
+	{
+		if (!info.allow_pipeline)
+			return false;
+		// the overlapping dimensions would each hold their columns next to the budget
+		if (info.column_budget)
+			return false;
+		const char *env = getenv("PERS_PIPELINE");
+		if (env && *env)
+			return atoi(env) != 0;
+		return std::thread::hardware_concurrency() > 1;
+	}
+
+	// If 'persRobM' is not NULL, it has the shape of 'phi' and the robustness of each vertex,
+	// the persistence of the pairs born or dying there, is added to it as the pairs are saved.
+	double calcPersistence( ValueArray * phi, const double pers_thd, 
+		vector<PersResultContainer> &result_lists, vector<Vertex> & _vList, const InputFileInfo &info,
+		WarmReduction *warm = NULL, PersistenceWorkspace<dim> *workspace = NULL,
+		blitz::Array<double, dim> * const persRobM = NULL)
 	{
 
 		time_t wholestart, wholeend, redstart, redend;
@@ -123,103 +295,266 @@ struct PersistenceCalculator {
 		
 		vector<Vertex> *vList = &_vList;
 
-/***********   compute dummyVList, sizes and cell2v_lists *******/
-		// we could save some memory by storing only one, but there's no point...
-		vector<int> dummyV(vList->size());
-		for (int i = 0; i < dummyV.size(); i++)
-			dummyV[i] = i;
-		vector<vector<int> > birth_lists(dim+1);
-		birth_lists[0] = dummyV;
-
-		vector< MatrixListType > dummyVList( vList->size() );
-		for (int i = 0; i < dummyVList.size(); i++)
-			dummyVList[i].push_back(i);
+		// the cell-to-vertex lists are only needed to save the representatives
+		const bool track = info.track_representatives;
+		const bool checkpointing = info.checkpoint_interval >= 0;
+
+		// The lists live in the workspace if there is one, in 'scratch' otherwise. Checkpoints,
+		// representatives and column budgets keep their columns to themselves. A warm start
+		// passes a workspace of its own, whose cell numbering it renumbers after the vertices
+		// that kept their place.
+		if (workspace && (track || checkpointing || info.resume || info.column_budget))
+			workspace = NULL;
+		const int renumber_from = (warm && workspace && warm->numbered) ? warm->prefix_vertices : 0;
+		if (warm)
+			warm->numbered = false;
+		PersistenceWorkspace<dim> scratch;
+		PersistenceWorkspace<dim> &ws = workspace ? *workspace : scratch;
+		ws.prepare(phi->shape(), renumber_from > 0);
+
+/***********   compute the vertex birth list, sizes and cell2v_lists *******/
+		vector<vector<int> > &birth_lists = ws.birth_lists;
+		birth_lists[0].resize(vList->size());
+		for (int i = 0; i < birth_lists[0].size(); i++)
+			birth_lists[0][i] = i;
+
 		vector< vector<MatrixListType > > cell2v_lists(dim+1);
-		cell2v_lists[0] = dummyVList;
+		if (track){
+			cell2v_lists[0].resize( vList->size() );
+			for (int i = 0; i < cell2v_lists[0].size(); i++)
+				cell2v_lists[0][i].push_back(i);
+		}
+
+		// Pairs of homology dimension d-1 come from reducing the cells of dimension d.
+		// Dimensions above the requested ones are still reduced (without saving anything)
+		// because their pivots clear columns of the next dimension; the ones below are skipped.
+		int lowest_d = dim + 1;
+		for (int d = dim; d >= 1; d--)
+			if (info.wantsHomologyDim(d-1))
+				lowest_d = d;
+
+		// A checkpoint replaces the sorting and everything reduced before it was taken.
+		const uint64_t fingerprint = (checkpointing || info.resume) ? inputFingerprint(*phi) : 0;
+		PersistenceCheckpoint<dim> ckpt;
+		bool resumed = false;
+		if (info.resume && ckpt.load(info.checkpoint_path)){
+			if (ckpt.fingerprint == fingerprint && ckpt.hom_dim_mask == info.hom_dim_mask
+				&& ckpt.track == (track && info.wantsHomologyDim(ckpt.d-1)) && ckpt.d >= lowest_d && ckpt.d <= dim){
+				resumed = true;
+				vList->swap(ckpt.vList);
+				DebuggerClass::console() << "resuming at dimension " << ckpt.d << ", column " << ckpt.next_column << endl;
+			}else{
+				DebuggerClass::console() << "checkpoint " << info.checkpoint_path << " belongs to another computation, starting over" << endl;
+			}
+		}
+		const int start_d = resumed ? ckpt.d : dim;
+
+		// the recorded column additions are not carried over
+		if (warm && (track || resumed))
+			warm = NULL;
+		if (warm){
+			warm->reduced.resize(dim+1);
+			warm->pivots.assign(dim, vector< pair<int, int> >());
+		}
 
 		int sizes[dim+1] = {0};
 
-		{
-			FiltrationGeneratorType filtration(phi);
-			filtration.init(vList);
+		// one filtration serves the cell lists and the boundaries of every dimension
+		FiltrationGeneratorType filtration(phi, &ws.filtration_order, &ws.max_value);
+		filtration.init(vList, renumber_from);
 
-			for (int i = 0; i <= dim; i++){
-				sizes[i] = filtration.getSizeInDim(i);
-				filtration.initList(vList, &birth_lists[i], &cell2v_lists[i], i);
-			}
-		}						  
+		for (int i = 0; i <= dim; i++){
+			sizes[i] = filtration.getSizeInDim(i);
+			if (i < lowest_d - 1)
+				continue;
+			bool cells_needed = track && (info.wantsHomologyDim(i) || (i > 0 && info.wantsHomologyDim(i-1)));
+			filtration.initList(vList, &birth_lists[i], cells_needed ? &cell2v_lists[i] : NULL, i);
+		}
+		if (warm)
+			warm->numbered = workspace != NULL;
 
 /****************************************************************/
 
-		vector<vector<int> > low_arrays(dim+1);
+		vector<vector<int> > &low_arrays = ws.low_arrays;
 		for (int i = 1; i <= dim; i++)
 			low_arrays[i].assign(sizes[i-1], BIG_INT);					  					  
-		vector<vector< MatrixListType > > boundaries(dim+1);
+		// the reduced boundary matrices; 'built' receives a new one before it is handed over
+		vector< ColumnStore > boundaries(dim+1);
+		vector< MatrixListType > built;
 		
-		vector<bool> willBeCleared(sizes[dim], false);						  
+		vector<bool> &willBeCleared = ws.will_be_cleared;
+		willBeCleared.assign(sizes[dim], false);						  
 /********** reduction list *******************/
 
-		// save for each negative simplex the simplices used to reduce it
-		vector< MatrixListType > reduction_list;
-		vector< MatrixListType > final_reduction_list;
-		vector< MatrixListType > final_boundary_list;
+		// save for each negative simplex the simplices used to reduce it;
+		// one per dimension, so that an export can run next to the following reduction
+		vector< ColumnStore > used_columns(dim+1);
+		for (int i = 1; i <= dim; i++){
+			boundaries[i].setBudget(info.column_budget, info.spill_dir);
+			if (track)
+				used_columns[i].setBudget(info.column_budget, info.spill_dir);
+		}
 /********************************************/
 
 		int num_pairs[dim] = {0};
 
-		for (int d = dim; d >= 1; d--)
+		// Pipeline: while d is reduced, the boundaries of d-1 are built on 'builder' from the
+		// pivots d publishes as it goes (see PivotFeed), so that few of the columns they clear
+		// are built; and the export of d runs while d-1 is reduced. A thread that fails is
+		// raised once it is joined; the guards join them if the reduction fails meanwhile.
+		const bool pipelined = usePipeline(info);
+		PivotFeed feed;
+		std::thread builder, exporter;
+		std::exception_ptr build_error, export_error;
+		ThreadJoiner build_joiner(builder, &feed), export_joiner(exporter);
+
+		CheckpointHook hook(info, fingerprint, *vList, result_lists, num_pairs, exporter);
+		// where the reduction of each dimension starts, after resumed or reused columns
+		vector<size_t> first_columns(dim+1, 0);
+
+		// Under a column budget the columns are streamed into their store as they are built;
+		// warm starts still reuse columns from a whole matrix.
+		const bool streamed = info.column_budget && !warm;
+
+		if (resumed){
+			for (int k = 0; k < dim; k++){
+				result_lists[k].swap(ckpt.results[k]);
+				num_pairs[k] = ckpt.num_pairs[k];
+			}
+			low_arrays[start_d].swap(ckpt.low_array);
+			first_columns[start_d] = ckpt.next_column;
+			if (streamed){
+				filtration.streamBoundaries(vList, &boundaries[start_d], start_d, ckpt.cleared);
+				for (size_t i = 0; i < first_columns[start_d]; i++){
+					setColumn(boundaries[start_d], i, ckpt.columns[i]);
+					myclear(ckpt.columns[i]);
+				}
+			}else{
+				filtration.calculateBoundaries(vList, &built, start_d, ckpt.cleared);
+				for (size_t i = 0; i < first_columns[start_d]; i++)
+					built[i].swap(ckpt.columns[i]);
+			}
+			if (ckpt.track){
+				resetColumns(used_columns[start_d], sizes[start_d]);
+				for (size_t i = 0; i < first_columns[start_d]; i++)
+					if (!ckpt.used[i].empty())
+						setColumn(used_columns[start_d], i, ckpt.used[i]);
+			}
+			hook.cleared.swap(ckpt.cleared);
+		}else if (streamed){
+			filtration.streamBoundaries(vList, &boundaries[dim], dim, willBeCleared);
+			hook.cleared = willBeCleared;
+		}else{
+			built.swap(ws.columns[dim]);
+			filtration.calculateBoundaries(vList, &built, dim, willBeCleared);
+			hook.cleared = willBeCleared;
+			first_columns[dim] = reuseWarmColumns(warm, dim, built, birth_lists[dim], low_arrays[dim]);
+		}
+		if (!streamed)
+			boundaries[start_d].adopt(built);
+
+		for (int d = start_d; d >= lowest_d; d--)
 		{						  
-			{
-				FiltrationGeneratorType filtration(phi);
-				filtration.init(vList);								  
-//				filtration.initList(vList, &birth_lists[d], &cell2v_lists[d], d);								  
-				filtration.calculateBoundaries(vList, &boundaries[d], d, willBeCleared);
-			}							  
+			const bool exported = info.wantsHomologyDim(d-1);
+			const bool track_d = track && exported;
+
+			if (checkpointing && d != start_d){
+				hook.cleared.assign(sizes[d], false);
+				for (size_t i = 0; i < hook.cleared.size(); i++)
+					hook.cleared[i] = low_arrays[d+1][i] != BIG_INT;
+			}
+			hook.d = d;
+			hook.track_d = track_d;
+			hook.low_array = &low_arrays[d];
+			hook.columns = &boundaries[d];
+			hook.used = &used_columns[d];
+
 			willBeCleared.assign(sizes[d-1], false);
+			if (first_columns[d] > 0)
+				for (size_t i = 0; i < low_arrays[d].size(); i++)
+					if (low_arrays[d][i] != BIG_INT)
+						willBeCleared[i] = true;
+			// the columns of d-1 cleared by resumed or reused pivots are known already
+			const bool build_next = pipelined && d - 1 >= lowest_d && !streamed;
+			if (build_next){
+				feed.reset(sizes[d-1], birth_lists[d], first_columns[d]);
+				for (size_t i = 0; i < willBeCleared.size(); i++)
+					if (willBeCleared[i])
+						feed.publish(i);
+				built.swap(ws.columns[d-1]);
+				builder = std::thread([&, d](){
+					try {
+						filtration.buildBoundaries(vList, birth_lists[d-1], &built, d-1, feed);
+					} catch (...) {
+						build_error = std::current_exception();
+					}
+				});
+			}
 			time(& redstart);
 
-			reduceND(willBeCleared, birth_lists[d], boundaries[d], low_arrays[d], reduction_list);
+			reduceND(willBeCleared, birth_lists[d], boundaries[d], low_arrays[d], track_d ? &used_columns[d] : NULL,
+				first_columns[d], checkpointing ? &hook : NULL, build_next ? &feed : NULL);
 
 			time(& redend);
 			redtime += difftime(redend,redstart);
 
-			cout << "reduced dimension " << d << endl;
-			
+			DebuggerClass::console() << "reduced dimension " << d << endl;
+
+			if (d - 1 >= lowest_d && streamed){
+				filtration.streamBoundaries(vList, &boundaries[d-1], d-1, willBeCleared);
+			}else if (d - 1 >= lowest_d){
+				if (build_next){
+					build_joiner.join(build_error);
+					// the columns built before the pivot clearing them was found
+					for (size_t i = 0; i < willBeCleared.size(); i++)
+						if (willBeCleared[i] && !built[i].empty())
+							myclear(built[i]);
+				}else{
+					built.swap(ws.columns[d-1]);
+					filtration.calculateBoundaries(vList, &built, d-1, willBeCleared);
+				}
+				first_columns[d-1] = reuseWarmColumns(warm, d-1, built, birth_lists[d-1], low_arrays[d-1]);
+				boundaries[d-1].adopt(built);
+			}
+
+			if( !exported ){
+				// only the pivots (willBeCleared) were needed
+				releaseBoundary(boundaries[d], d, warm, workspace);
+				continue;
+			}
+
 			// save persistence, boundaries, red_list for this dim
 			// so that the memory could be cleaned
-			SavePersistence(phi, *vList, birth_lists[d-1], low_arrays[d], num_pairs[d-1], birth_lists[d], pers_thd, result_lists[d-1], 
-				//*persRobM,
-				reduction_list, cell2v_lists[d], final_reduction_list, boundaries[d], cell2v_lists[d-1], final_boundary_list);
-
-		if( !info.from_python ){
-			BinaryPersistentPairsSaver<dim> binSaver;
-			stringstream output_red_file;
-			output_red_file << info.input_path;
-			output_red_file << ".red." << d;
-			binSaver.saveOneDimReduction(final_reduction_list, (* vList), output_red_file.str().c_str(), d);		
-			stringstream output_boundary_file;
-			output_boundary_file << info.input_path;
-			output_boundary_file << ".bnd." << d;
-			binSaver.saveOneDimReduction(final_boundary_list, (* vList), output_boundary_file.str().c_str(), d);	
+			export_joiner.join(export_error);
+			if (pipelined)
+				exporter = std::thread([&, d, track_d](){
+					try {
+						exportDimension(phi, pers_thd, d, track_d, *vList, birth_lists, low_arrays, num_pairs[d-1], result_lists[d-1], 
+							used_columns[d], cell2v_lists, boundaries[d], info, warm, workspace, persRobM);
+					} catch (...) {
+						export_error = std::current_exception();
+					}
+				});
+			else
+				exportDimension(phi, pers_thd, d, track_d, *vList, birth_lists, low_arrays, num_pairs[d-1], result_lists[d-1], 
+					used_columns[d], cell2v_lists, boundaries[d], info, warm, workspace, persRobM);
 		}
 
+		export_joiner.join(export_error);
 
-			cout << "saved dimension " << d << endl;
-
-			reduction_list.clear();
-			final_reduction_list.clear();
-			boundaries[d].clear();
-			final_boundary_list.clear();
-		}
+		// the results are complete, the checkpoint is of no use anymore (also when it was
+		// only resumed from, so that a later --resume does not load it again)
+		if (checkpointing || resumed)
+			remove(info.checkpoint_path.c_str());
 
 		OUTPUT_MSG( "Reduction done" );
 
 		time(& wholeend);
 		wholetime = difftime(wholeend,wholestart);
-		cout << "@@@@@@@@@@@@@@@@@@@@@@@@@@@@" << endl;
-		cout << "Filtration building time = " << (wholetime-redtime) / 60.0 << " Min" << endl;
-		cout << "Reduction  time          = " << redtime / 60.0 << " Min" << endl;
-		cout << "@@@@@@@@@@@@@@@@@@@@@@@@@@@@" << endl;
+		DebuggerClass::console() << "@@@@@@@@@@@@@@@@@@@@@@@@@@@@" << endl;
+		DebuggerClass::console() << "Filtration building time = " << (wholetime-redtime) / 60.0 << " Min" << endl;
+		DebuggerClass::console() << "Reduction  time          = " << redtime / 60.0 << " Min" << endl;
+		DebuggerClass::console() << "@@@@@@@@@@@@@@@@@@@@@@@@@@@@" << endl;
 
 		OUTPUT_MSG( "Recording persistence pairs" )
 
@@ -230,13 +565,15 @@ struct PersistenceCalculator {
 				pers_thd, result_lists[d], *persRobM,
 				reduction_lists[d+1], cell2v_lists[d+1], final_reduction_lists[d]);
 
-			cout << "saved dimension " << d << endl;
+			DebuggerClass::console() << "saved dimension " << d << endl;
 		}
 */
-		MY_ASSERT(num_pairs[0]+1==birth_lists[0].size());
-		for (int i = 1; i < dim - 1; i++)
-			MY_ASSERT(num_pairs[i] + num_pairs[i+1]==birth_lists[i+1].size());
-		MY_ASSERT(num_pairs[dim-1]==birth_lists[dim].size());		
+		if (lowest_d == 1 && info.wantsAllHomologyDims()){
+			MY_ASSERT(num_pairs[0]+1==birth_lists[0].size());
+			for (int i = 1; i < dim - 1; i++)
+				MY_ASSERT(num_pairs[i] + num_pairs[i+1]==birth_lists[i+1].size());
+			MY_ASSERT(num_pairs[dim-1]==birth_lists[dim].size());		
+		}
 
 		OUTPUT_MSG( "Finished");
 
@@ -0,0 +1,159 @@
+"""
+Client of the persistence server (PersistenceServer.cpp, built with `make server`).
+
+Start one server per machine,
+    ./PersistenceServer_gcc /tmp/persistence.sock
+and use a client per process instead of loading PersistencePython.so:
+    client = PersistenceClient('/tmp/persistence.sock')
+    res = client.cubePers(f, list(f.shape), 0.001, hom_dims=[1])
+
+The image is copied once into a POSIX shared memory object owned by the client (reused and
+grown across calls); only its name goes over the socket. The results are the same as those
+of PersistencePython.cubePers and cubePersArrays.
+"""
+
+import array
+import itertools
+import mmap
+import os
+import socket
+import struct
+
+# ServerRequest and ServerResponse of PersistenceServer.cpp
+_REQUEST = struct.Struct('=4sii4iI2id64s')
+_RESPONSE = struct.Struct('=4siiiQQ')
+_REQUEST_MAGIC = b'PQR1'
+_RESPONSE_MAGIC = b'PQS1'
+_SHM_DIR = '/dev/shm'
+
+_segment_ids = itertools.count()
+
+
+class PersistenceClient(object):
+
+    def __init__(self, socket_path='/tmp/persistence.sock'):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(socket_path)
+        self.shm_name = '/pers-client-%d-%d' % (os.getpid(), next(_segment_ids))
+        self.shm_size = 0
+        self.shm = None
+
+    def close(self):
+        if self.sock is not None:
+            self.sock.close()
+            self.sock = None
+        if self.shm is not None:
+            self.shm.close()
+            self.shm = None
+            os.unlink(_SHM_DIR + self.shm_name)
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def __del__(self):
+        try:
+            self.close()
+        except Exception:
+            pass
+
+    def cubePersArrays(self, entries, dims, pers_thd, hom_dims=[]):
+        """
+        Same as PersistencePython.cubePersArrays: a dict of 'dims', 'births', 'deaths',
+        'persistence' (one value per pair) and 'birth_coords', 'death_coords' (one row of
+        len(dims) coordinates per pair), as memoryviews that np.asarray wraps without copying.
+        """
+        view = self._image(entries)
+        n = 1
+        for d in dims:
+            n *= d
+        if not 1 <= len(dims) <= 4 or n != len(view):
+            raise RuntimeError('cubePersArrays: dims do not match the size of the image')
+        self._write_image(view)
+
+        mask = 0xFFFFFFFF
+        if hom_dims:
+            mask = 0
+            for k in hom_dims:
+                mask |= 1 << k
+        padded = list(dims) + [0] * (4 - len(dims))
+        self.sock.sendall(_REQUEST.pack(_REQUEST_MAGIC, view.itemsize, len(dims), *(padded + [mask, 0, 0, pers_thd, self.shm_name.encode()])))
+
+        magic, status, dim, _, num_pairs, message_length = _RESPONSE.unpack(self._recv(_RESPONSE.size))
+        if magic != _RESPONSE_MAGIC:
+            raise RuntimeError('cubePersArrays: bad response from the persistence server')
+        if status != 0:
+            raise RuntimeError('cubePersArrays: ' + bytes(self._recv(message_length)).decode())
+
+        sizes = [('dims', 'i', num_pairs), ('births', 'd', num_pairs), ('deaths', 'd', num_pairs),
+                 ('persistence', 'd', num_pairs), ('birth_coords', 'i', num_pairs * dim),
+                 ('death_coords', 'i', num_pairs * dim)]
+        data = self._recv(sum(struct.calcsize(t) * m for _, t, m in sizes))
+        res = {}
+        offset = 0
+        for key, t, m in sizes:
+            nbytes = struct.calcsize(t) * m
+            column = data[offset:offset + nbytes]
+            res[key] = column.cast(t, [num_pairs, dim]) if key.endswith('coords') and num_pairs else column.cast(t)
+            offset += nbytes
+        return res
+
+    def cubePers(self, entries, dims, pers_thd, hom_dims=[]):
+        """
+        Same as PersistencePython.cubePers: one row per pair,
+        [dim, birth, death, persistence, birth coordinates..., death coordinates...].
+        """
+        res = self.cubePersArrays(entries, dims, pers_thd, hom_dims)
+        k = len(dims)
+        bc = res['birth_coords'].cast('B').cast('i')
+        dc = res['death_coords'].cast('B').cast('i')
+        return [[float(res['dims'][i]), res['births'][i], res['deaths'][i], res['persistence'][i]]
+                + [float(c) for c in bc[i * k:(i + 1) * k]] + [float(c) for c in dc[i * k:(i + 1) * k]]
+                for i in range(len(res['dims']))]
+
+    @staticmethod
+    def _image(entries):
+        # float32/float64 buffers (NumPy arrays in C order, array.array) are used as they are
+        try:
+            view = memoryview(entries)
+        except TypeError:
+            return memoryview(array.array('d', entries))
+        if view.format not in ('d', 'f') or not view.c_contiguous:
+            return memoryview(array.array('d', _flatten(view.tolist())))
+        return view.cast('B').cast(view.format)
+
+    def _write_image(self, view):
+        nbytes = len(view) * view.itemsize
+        if nbytes > self.shm_size:
+            if self.shm is not None:
+                self.shm.close()
+            fd = os.open(_SHM_DIR + self.shm_name, os.O_CREAT | os.O_RDWR, 0o600)
+            try:
+                os.ftruncate(fd, nbytes)
+                self.shm = mmap.mmap(fd, nbytes)
+            finally:
+                os.close(fd)
+            self.shm_size = nbytes
+        self.shm[:nbytes] = view.cast('B')
+
+    def _recv(self, nbytes):
+        buf = bytearray(nbytes)
+        view = memoryview(buf)
+        got = 0
+        while got < nbytes:
+            r = self.sock.recv_into(view[got:])
+            if r == 0:
+                raise RuntimeError('the persistence server closed the connection')
+            got += r
+        return view
+
+
+def _flatten(x):
+    if isinstance(x, list):
+        for y in x:
+            for z in _flatten(y):
+                yield z
+    else:
+        yield x
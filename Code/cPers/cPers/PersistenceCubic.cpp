@@ -40,7 +40,7 @@ int main(int argc, const char* argv[]){
 
 	if (argc < 2)
 	{
-		std::cout << "usage: " << argv[0] << " input_file.ext" << std::endl;		
+		std::cout << "usage: " << argv[0] << " input_file.ext [--mem-budget MB] [--spill-dir DIR] [--checkpoint SECONDS] [--resume]" << std::endl;		
 		return 1;
 	}		
 
@@ -52,6 +52,23 @@ int main(int argc, const char* argv[]){
 	DebuggerClass::init( false, lfile, efile );
 	
 	InputFileInfo input_file_info(input_file);
+
+	for (int i = 2; i < argc; i++)
+	{
+		string opt = argv[i];
+		if (opt == "--resume")
+			input_file_info.resume = true;
+		else if (opt != "--mem-budget" && opt != "--spill-dir" && opt != "--checkpoint")
+			std::cout << "unknown option " << opt << std::endl;
+		else if (i + 1 == argc)
+			std::cout << "missing value for " << opt << std::endl;
+		else if (opt == "--mem-budget")
+			input_file_info.column_budget = (size_t)(atof(argv[++i]) * 1024 * 1024);
+		else if (opt == "--spill-dir")
+			input_file_info.spill_dir = argv[++i];
+		else
+			input_file_info.checkpoint_interval = atof(argv[++i]);
+	}
 	
 	int max_pers_pts = BIG_INT; // the maximal number of persistence pairs recorded
 
@@ -32,6 +32,11 @@ typedef int CellNrType; // it could be long for really large inputs...
 
 #include "PersistenceCalculator.h"
 #include "PersistenceCalcRunner.h"
+#include "ThreadPool.h"
+#include "DLPack.h"
+#include "DiagramCache.h"
+#include "TopoLoss.h"
+#include "PersistenceQueue.h"
 
 
 // python thingy
@@ -57,13 +62,29 @@ namespace py = pybind11;
 // }
 // 
 
-std::vector<std::vector<double> > cubePers(std::vector< double > &entries, std::vector<int> dims, double pers_thd ) {
+// hom_dims lists the homology dimensions to compute; empty means all of them.
+void setHomologyDims(InputFileInfo &input_file_info, const std::vector<int> &hom_dims) {
+	if (!hom_dims.empty()){
+		input_file_info.hom_dim_mask = 0;
+		for (size_t i = 0; i < hom_dims.size(); i++){
+			int k = hom_dims[i];
+			if (k < 0 || k >= input_file_info.dimension)
+				throw std::runtime_error("hom_dims: " + std::to_string(k) + " is not a homology dimension of a "
+					+ std::to_string(input_file_info.dimension) + "D image");
+			input_file_info.hom_dim_mask |= 1u << k;
+		}
+	}
+}
+
+std::vector<std::vector<double> > cubePers(std::vector< double > &entries, std::vector<int> dims, double pers_thd, std::vector<int> hom_dims, bool binary ) {
 	string lfile = "log.txt";	
 	string efile = "error.txt";	
 	DebuggerClass::init( true, lfile, efile );
 	
         int dim = dims.size();
 	InputFileInfo input_file_info(dim);
+	setHomologyDims(input_file_info, hom_dims);
+	input_file_info.allow_mask_path = binary;
 	
 	int max_pers_pts = BIG_INT; // the maximal number of persistence pairs recorded
         
@@ -111,10 +132,995 @@ std::vector<std::vector<double> > cubePers(std::vector< double > &entries, std::
 	return ret;
 }
 
+// Element type of a buffer: 'd', 'f', 'i' (int32) or 'q' (int64) (native or little-endian
+// byte order), 0 for anything else.
+char bufferElementType(const py::buffer_info &buf) {
+	string format = buf.format;
+	if (format.size() == 2 && (format[0] == '@' || format[0] == '=' || format[0] == '<'))
+		format = format.substr(1);
+	if (format == "d" && buf.itemsize == sizeof(double))
+		return 'd';
+	if (format == "f" && buf.itemsize == sizeof(float))
+		return 'f';
+	if ((format == "i" || format == "l") && buf.itemsize == sizeof(int32_t))
+		return 'i';
+	if ((format == "q" || format == "l") && buf.itemsize == sizeof(int64_t))
+		return 'q';
+	return 0;
+}
+
+// Checks that the buffer holds a C-ordered image of prod(dims) floats or doubles and returns 'f' or 'd'.
+char checkImageBuffer(const py::buffer_info &buf, const std::vector<int> &dims) {
+	char type = bufferElementType(buf);
+	if (type != 'd' && type != 'f')
+		throw std::runtime_error("cubePers: the image has to be float32 or float64, got format '" + buf.format + "'");
+
+	size_t expected = buf.itemsize;
+	for (int i = buf.ndim - 1; i >= 0; i--){
+		if (buf.shape[i] > 1 && buf.strides[i] != expected)
+			throw std::runtime_error("cubePers: the image has to be C-contiguous");
+		expected *= buf.shape[i];
+	}
+
+	size_t n = 1;
+	for (size_t i = 0; i < dims.size(); i++)
+		n *= dims[i];
+	if (dims.empty() || dims.size() > 4 || n != buf.size)
+		throw std::runtime_error("cubePers: dims do not match the size of the image");
+	return type;
+}
+
+// An array lent by Python for the duration of a call: a buffer (NumPy array, array.array) or a
+// DLPack capsule of a CPU tensor (torch.utils.dlpack.to_dlpack(t)). A buffer cannot be freed or
+// resized meanwhile. A capsule is consumed as DLPack asks: it is renamed "used_dltensor" and the
+// tensor's deleter is called when the array is released, so it can be passed only once.
+struct HeldImage {
+	Py_buffer view;
+	bool held;
+	DLManagedTensor *managed;
+	void *data;
+	char type;		// as bufferElementType
+	size_t size;
+	std::vector<int> dims;	// its shape
+
+	HeldImage() : held(false), managed(NULL), data(NULL), type(0), size(0) {}
+	~HeldImage() {
+		if (held)
+			PyBuffer_Release(&view);
+		if (managed && managed->deleter)
+			managed->deleter(managed);
+	}
+};
+
+char dlpackElementType(const DLDataType &t) {
+	if (t.lanes != 1)
+		return 0;
+	if (t.code == kDLFloat)
+		return t.bits == 64 ? 'd' : t.bits == 32 ? 'f' : 0;
+	if (t.code == kDLInt)
+		return t.bits == 64 ? 'q' : t.bits == 32 ? 'i' : 0;
+	return 0;
+}
+
+// Takes hold of 'obj', which must be C-contiguous (and writable if 'writable').
+void holdArray(py::handle obj, HeldImage &h, bool writable, const string &what) {
+	if (PyCapsule_IsValid(obj.ptr(), kDLTensorCapsuleName)){
+		DLManagedTensor *managed = static_cast<DLManagedTensor *>(PyCapsule_GetPointer(obj.ptr(), kDLTensorCapsuleName));
+		const DLTensor &t = managed->dl_tensor;
+		if (t.ctx.device_type != kDLCPU && t.ctx.device_type != kDLCPUPinned)
+			throw std::runtime_error(what + ": only CPU tensors can be read, move the tensor with .cpu() first");
+		char type = dlpackElementType(t.dtype);
+		if (!type)
+			throw std::runtime_error(what + ": unsupported tensor element type");
+		int64_t expected = 1;
+		for (int i = t.ndim - 1; i >= 0; i--){
+			if (t.strides && t.shape[i] > 1 && t.strides[i] != expected)
+				throw std::runtime_error(what + ": the tensor has to be contiguous");
+			expected *= t.shape[i];
+		}
+		PyCapsule_SetName(obj.ptr(), kDLTensorUsedCapsuleName);
+		h.managed = managed;
+		h.data = static_cast<char *>(t.data) + t.byte_offset;
+		h.type = type;
+		h.size = expected;
+		h.dims.assign(t.shape, t.shape + t.ndim);
+		return;
+	}
+	if (PyCapsule_CheckExact(obj.ptr()))
+		throw std::runtime_error(what + ": the capsule is not an unused DLPack tensor");
+
+	if (PyObject_GetBuffer(obj.ptr(), &h.view, PyBUF_STRIDES | PyBUF_FORMAT | (writable ? PyBUF_WRITABLE : 0)) != 0)
+		throw py::error_already_set();
+	h.held = true;
+	std::vector<size_t> shape(h.view.ndim), strides(h.view.ndim);
+	for (int k = 0; k < h.view.ndim; k++){
+		shape[k] = h.view.shape[k];
+		strides[k] = h.view.strides[k];
+		h.dims.push_back(h.view.shape[k]);
+	}
+	py::buffer_info info(h.view.buf, h.view.itemsize, h.view.format, h.view.ndim, shape, strides);
+	size_t expected = info.itemsize;
+	for (int i = info.ndim - 1; i >= 0; i--){
+		if (info.shape[i] > 1 && info.strides[i] != expected)
+			throw std::runtime_error(what + ": the array has to be C-contiguous");
+		expected *= info.shape[i];
+	}
+	h.data = h.view.buf;
+	h.type = bufferElementType(info);
+	h.size = info.size;
+	if (!h.type)
+		throw std::runtime_error(what + ": unsupported element type '" + info.format + "'");
+}
+
+// Holds an image as for cubePers; 'dims' empty means the array's own shape.
+void holdImage(py::handle obj, HeldImage &h, std::vector<int> &dims, const string &what) {
+	holdArray(obj, h, false, what);
+	if (h.type != 'd' && h.type != 'f')
+		throw std::runtime_error(what + ": the image has to be float32 or float64");
+	if (dims.empty())
+		dims = h.dims;
+	size_t n = 1;
+	for (size_t i = 0; i < dims.size(); i++)
+		n *= dims[i];
+	if (dims.empty() || dims.size() > 4 || n != h.size)
+		throw std::runtime_error(what + ": dims do not match the size of the image");
+}
+
+template<typename ValueT>
+std::vector<std::vector<double> > runBuffer(InputFileInfo &input_file_info, std::vector<int> dims, ValueT *data, double pers_thd) {
+	switch(input_file_info.dimension)
+	{
+	case 1:
+		return InputRunner<1>::run_buffer(input_file_info, dims, data, pers_thd);
+	case 2:
+		return InputRunner<2>::run_buffer(input_file_info, dims, data, pers_thd);
+	case 3:
+		return InputRunner<3>::run_buffer(input_file_info, dims, data, pers_thd);
+	case 4:
+		return InputRunner<4>::run_buffer(input_file_info, dims, data, pers_thd);
+        default:
+                assert(false);
+	}
+	return std::vector<std::vector<double> >();
+}
+
+// cubePers on a NumPy array (or anything else with the buffer protocol) of float32 or float64,
+// read in place. The buffer must be C-contiguous and hold prod(dims) values; its own shape
+// does not matter, so a flattened array works as well.
+// With 'binary', an image of two values is taken for a mask and computed from
+// its connected components (MaskPersistence.h): the same pairs, though the birth and death
+// pixels may be others of the same components than those of the reduction.
+template<typename ValueT>
+std::vector<std::vector<double> > cubePersImage(ValueT *data, std::vector<int> dims, double pers_thd, std::vector<int> hom_dims, bool binary ) {
+	string lfile = "log.txt";	
+	string efile = "error.txt";	
+	DebuggerClass::init( true, lfile, efile );
+
+	InputFileInfo input_file_info(dims.size());
+	setHomologyDims(input_file_info, hom_dims);
+	input_file_info.allow_mask_path = binary;
+
+	std::vector<std::vector<double> > ret = runBuffer(input_file_info, dims, data, pers_thd);
+
+	DebuggerClass::finish();
+	return ret;
+}
+
+std::vector<std::vector<double> > cubePersBuffer(py::buffer entries, std::vector<int> dims, double pers_thd, std::vector<int> hom_dims, bool binary ) {
+	py::buffer_info buf = entries.request();
+	if (checkImageBuffer(buf, dims) == 'd')
+		return cubePersImage(static_cast<double *>(buf.ptr), dims, pers_thd, hom_dims, binary);
+	return cubePersImage(static_cast<float *>(buf.ptr), dims, pers_thd, hom_dims, binary);
+}
+
+// cubePers on a DLPack capsule of a float32/float64 CPU tensor, read in place (the capsule is
+// consumed). Empty dims stand for the shape of the tensor.
+std::vector<std::vector<double> > cubePersCapsule(py::capsule entries, std::vector<int> dims, double pers_thd, std::vector<int> hom_dims, bool binary ) {
+	HeldImage h;
+	holdImage(entries, h, dims, "cubePers");
+	if (h.type == 'd')
+		return cubePersImage(static_cast<double *>(h.data), dims, pers_thd, hom_dims, binary);
+	return cubePersImage(static_cast<float *>(h.data), dims, pers_thd, hom_dims, binary);
+}
+
+// One column of a PersDiagramArrays, exposed through the buffer protocol so that
+// numpy.asarray() wraps it without copying. It keeps the whole result alive.
+struct PairColumn {
+	std::shared_ptr<PersDiagramArrays> owner;
+	void *data;
+	size_t itemsize;
+	std::string format;
+	size_t rows, cols;	// cols == 0 for a vector
+};
+
+template<typename T>
+py::object pairColumn(const std::shared_ptr<PersDiagramArrays> &owner, std::vector<T> &v, size_t cols) {
+	size_t rows = cols ? v.size() / cols : v.size();
+	PairColumn *c = new PairColumn{owner, v.empty() ? NULL : &v[0], sizeof(T), py::format_descriptor<T>::value(), rows, cols};
+	return py::cast(c, py::return_value_policy::take_ownership);
+}
+
+// runArrays with the buffers of a workspace the caller holds
+template<typename ValueT>
+void runArraysOn(PersistenceWorkspaces &ws, InputFileInfo &input_file_info, std::vector<int> dims, ValueT *data, double pers_thd,
+	PersDiagramArrays &out, double *robustness = NULL) {
+	switch(input_file_info.dimension)
+	{
+	case 1:
+		InputRunner<1>::run_arrays(input_file_info, dims, data, pers_thd, out, &ws.of<1>(), robustness);
+		break;
+	case 2:
+		InputRunner<2>::run_arrays(input_file_info, dims, data, pers_thd, out, &ws.of<2>(), robustness);
+		break;
+	case 3:
+		InputRunner<3>::run_arrays(input_file_info, dims, data, pers_thd, out, &ws.of<3>(), robustness);
+		break;
+	case 4:
+		InputRunner<4>::run_arrays(input_file_info, dims, data, pers_thd, out, &ws.of<4>(), robustness);
+		break;
+        default:
+                assert(false);
+	}
+}
+
+// The buffers of the computation come from the process's pool of workspaces, so that
+// repeated calls on images of the same shape do not allocate them again. 'robustness', if
+// not NULL, receives the robustness map (see PersistenceCalcRunner::go_python_arrays).
+template<typename ValueT>
+void runArrays(InputFileInfo &input_file_info, std::vector<int> dims, ValueT *data, double pers_thd, PersDiagramArrays &out,
+	double *robustness = NULL) {
+	PooledWorkspace ws;
+	runArraysOn(*ws, input_file_info, dims, data, pers_thd, out, robustness);
+}
+
+py::dict arraysToDict(const std::shared_ptr<PersDiagramArrays> &res);
+
+// The pairs of cubePers as a dict of arrays instead of a list of rows:
+// 'dims' (int32), 'births', 'deaths', 'persistence' (float64), and 'birth_coords',
+// 'death_coords' (int32, one row of len(dims) coordinates per pair).
+// The image is a buffer as for cubePers, or a list.
+template<typename ValueT>
+py::dict diagramArrays(ValueT *data, std::vector<int> dims, double pers_thd, std::vector<int> hom_dims, bool binary ) {
+	string lfile = "log.txt";	
+	string efile = "error.txt";	
+	DebuggerClass::init( true, lfile, efile );
+
+	InputFileInfo input_file_info(dims.size());
+	setHomologyDims(input_file_info, hom_dims);
+	input_file_info.allow_mask_path = binary;
+
+	std::shared_ptr<PersDiagramArrays> res = std::make_shared<PersDiagramArrays>();
+	runArrays(input_file_info, dims, data, pers_thd, *res);
+
+	DebuggerClass::finish();
+
+	return arraysToDict(res);
+}
+
+py::dict arraysToDict(const std::shared_ptr<PersDiagramArrays> &res) {
+	py::dict d;
+	d[py::str("dims")] = pairColumn(res, res->hom_dim, 0);
+	d[py::str("births")] = pairColumn(res, res->birth, 0);
+	d[py::str("deaths")] = pairColumn(res, res->death, 0);
+	d[py::str("persistence")] = pairColumn(res, res->persistence, 0);
+	d[py::str("birth_coords")] = pairColumn(res, res->birth_coords, res->dim);
+	d[py::str("death_coords")] = pairColumn(res, res->death_coords, res->dim);
+	return d;
+}
+
+py::dict cubePersArraysBuffer(py::buffer entries, std::vector<int> dims, double pers_thd, std::vector<int> hom_dims, bool binary ) {
+	py::buffer_info buf = entries.request();
+	if (checkImageBuffer(buf, dims) == 'd')
+		return diagramArrays(static_cast<double *>(buf.ptr), dims, pers_thd, hom_dims, binary);
+	return diagramArrays(static_cast<float *>(buf.ptr), dims, pers_thd, hom_dims, binary);
+}
+
+py::dict cubePersArraysCapsule(py::capsule entries, std::vector<int> dims, double pers_thd, std::vector<int> hom_dims, bool binary ) {
+	HeldImage h;
+	holdImage(entries, h, dims, "cubePersArrays");
+	if (h.type == 'd')
+		return diagramArrays(static_cast<double *>(h.data), dims, pers_thd, hom_dims, binary);
+	return diagramArrays(static_cast<float *>(h.data), dims, pers_thd, hom_dims, binary);
+}
+
+py::dict cubePersArrays(std::vector< double > &entries, std::vector<int> dims, double pers_thd, std::vector<int> hom_dims, bool binary ) {
+	size_t n = 1;
+	for (size_t i = 0; i < dims.size(); i++)
+		n *= dims[i];
+	if (dims.empty() || dims.size() > 4 || n != entries.size())
+		throw std::runtime_error("cubePersArrays: dims do not match the size of the image");
+	return diagramArrays(&entries[0], dims, pers_thd, hom_dims, binary);
+}
+
+// cubePersArrays of a large image from coarse to fine (see MultiResPersistence.h): the
+// diagrams of a pyramid of 'levels' levels of block minima and maxima find the candidate
+// pairs, which are computed exactly on their regions of the image. Only dimensions 0 and
+// len(dims)-1; pairs whose ridge is thinner than a block of 2^levels pixels can be missed.
+// Images this cannot apply to (other dimensions wanted, too small) are computed as a whole.
+py::dict cubePersMultiRes(py::object entries, std::vector<int> dims, double pers_thd, int levels, std::vector<int> hom_dims ) {
+	HeldImage h;
+	holdImage(entries, h, dims, "cubePersMultiRes");
+	if (levels < 1)
+		throw std::runtime_error("cubePersMultiRes: levels has to be positive");
+
+	string lfile = "log.txt";	
+	string efile = "error.txt";	
+	DebuggerClass::init( true, lfile, efile );
+
+	InputFileInfo input_file_info(dims.size());
+	setHomologyDims(input_file_info, hom_dims);
+	input_file_info.multires_levels = levels;
+
+	std::shared_ptr<PersDiagramArrays> res = std::make_shared<PersDiagramArrays>();
+	if (h.type == 'd')
+		runArrays(input_file_info, dims, static_cast<double *>(h.data), pers_thd, *res);
+	else
+		runArrays(input_file_info, dims, static_cast<float *>(h.data), pers_thd, *res);
+
+	DebuggerClass::finish();
+
+	return arraysToDict(res);
+}
+
+template<typename T>
+void copyColumn(const std::vector<T> &from, HeldImage &to) {
+	switch (to.type)
+	{
+	case 'd':
+		std::copy(from.begin(), from.end(), static_cast<double *>(to.data));
+		break;
+	case 'f':
+		std::copy(from.begin(), from.end(), static_cast<float *>(to.data));
+		break;
+	case 'i':
+		std::copy(from.begin(), from.end(), static_cast<int32_t *>(to.data));
+		break;
+	case 'q':
+		std::copy(from.begin(), from.end(), static_cast<int64_t *>(to.data));
+		break;
+	}
+}
+
+// cubePersArrays writing into arrays of the caller instead of returning new ones, e.g. pinned
+// tensors allocated once. 'out' maps some of the keys of cubePersArrays to writable C-contiguous
+// buffers or DLPack capsules: float32/float64 for 'births', 'deaths' and 'persistence', int32/int64
+// for 'dims' and the coordinates. Each needs room for all pairs (coordinates: pairs * len(dims)
+// values). Returns the number of pairs; if an array is too small, raises and writes none of them.
+// 'robustness' (float32/float64, as many values as the image) receives the robustness map:
+// for each pixel, the sum of the persistence of the pairs born or dying there. Its size is
+// checked first; a float64 array is then written in place as the pairs are found (so also
+// when a pair column turns out too small), a float32 one along with the pair columns.
+// The image is a buffer or a DLPack capsule, as for cubePers.
+int cubePersArraysInto(py::object entries, std::vector<int> dims, double pers_thd, py::dict out, std::vector<int> hom_dims ) {
+	static const char *keys[] = {"dims", "births", "deaths", "persistence", "birth_coords", "death_coords", "robustness"};
+	std::map<string, HeldImage> columns;
+	HeldImage robustness;
+	for (auto item : out){
+		string key = py::str(item.first, true);
+		if (std::find(keys, keys + 7, key) == keys + 7)
+			throw std::runtime_error("cubePersArraysInto: unknown output '" + key + "'");
+		HeldImage &h = key == "robustness" ? robustness : columns[key];
+		holdArray(item.second, h, true, "cubePersArraysInto: '" + key + "'");
+		bool float_column = key == "births" || key == "deaths" || key == "persistence" || key == "robustness";
+		if (float_column != (h.type == 'd' || h.type == 'f'))
+			throw std::runtime_error("cubePersArraysInto: '" + key + "' has the wrong element type");
+	}
+
+	HeldImage image;
+	holdImage(entries, image, dims, "cubePersArraysInto");
+	if (robustness.data && robustness.size != image.size)
+		throw std::runtime_error("cubePersArraysInto: 'robustness' holds " + std::to_string(robustness.size)
+			+ " values, the image " + std::to_string(image.size));
+
+	string lfile = "log.txt";	
+	string efile = "error.txt";	
+	DebuggerClass::init( true, lfile, efile );
+	InputFileInfo input_file_info(dims.size());
+	setHomologyDims(input_file_info, hom_dims);
+
+	// the pairs and a float32 robustness map go through buffers of a pooled workspace,
+	// so that repeated calls do not allocate them
+	PooledWorkspace ws;
+	PersDiagramArrays &res = ws->pairs;
+	std::vector<double> &robustness_values = ws->robustness;
+	res.hom_dim.clear();
+	res.birth.clear();
+	res.death.clear();
+	res.persistence.clear();
+	res.birth_coords.clear();
+	res.death_coords.clear();
+	double *robustness_map = NULL;
+	if (robustness.type == 'd')
+		robustness_map = static_cast<double *>(robustness.data);
+	else if (robustness.type == 'f'){
+		robustness_values.resize(robustness.size);
+		robustness_map = &robustness_values[0];
+	}
+	if (image.type == 'd')
+		runArraysOn(*ws, input_file_info, dims, static_cast<double *>(image.data), pers_thd, res, robustness_map);
+	else
+		runArraysOn(*ws, input_file_info, dims, static_cast<float *>(image.data), pers_thd, res, robustness_map);
+	DebuggerClass::finish();
+
+	size_t n = res.hom_dim.size();
+	std::map<string, HeldImage>::iterator it;
+	for (it = columns.begin(); it != columns.end(); ++it){
+		size_t needed = it->first.find("coords") != string::npos ? n * dims.size() : n;
+		if (it->second.size < needed)
+			throw std::runtime_error("cubePersArraysInto: '" + it->first + "' holds " + std::to_string(it->second.size)
+				+ " values, " + std::to_string(needed) + " are needed");
+	}
+	for (it = columns.begin(); it != columns.end(); ++it){
+		if (it->first == "dims")
+			copyColumn(res.hom_dim, it->second);
+		else if (it->first == "births")
+			copyColumn(res.birth, it->second);
+		else if (it->first == "deaths")
+			copyColumn(res.death, it->second);
+		else if (it->first == "persistence")
+			copyColumn(res.persistence, it->second);
+		else if (it->first == "birth_coords")
+			copyColumn(res.birth_coords, it->second);
+		else
+			copyColumn(res.death_coords, it->second);
+	}
+	if (robustness.type == 'f')
+		copyColumn(robustness_values, robustness);
+	return n;
+}
+
+// cubePersArrays through a DiagramCache: an image seen before (same bytes, element type, dims
+// and parameters) is answered from the cache. The image is a buffer, a DLPack capsule or a list.
+std::shared_ptr<PersDiagramArrays> cachedDiagram(DiagramCache &cache, py::object entries, std::vector<int> dims, double pers_thd, std::vector<int> hom_dims ) {
+	HeldImage h;
+	std::vector<double> list_entries;
+	const void *data;
+	char type;
+	if (PyList_Check(entries.ptr())){
+		list_entries = entries.cast< std::vector<double> >();
+		size_t n = 1;
+		for (size_t i = 0; i < dims.size(); i++)
+			n *= dims[i];
+		if (dims.empty() || dims.size() > 4 || n != list_entries.size())
+			throw std::runtime_error("DiagramCache: dims do not match the size of the image");
+		data = &list_entries[0];
+		type = 'd';
+	}else{
+		holdImage(entries, h, dims, "DiagramCache");
+		data = h.data;
+		type = h.type;
+	}
+
+	string lfile = "log.txt";	
+	string efile = "error.txt";	
+	DebuggerClass::init( true, lfile, efile );
+	InputFileInfo input_file_info(dims.size());
+	setHomologyDims(input_file_info, hom_dims);
+
+	std::shared_ptr<PersDiagramArrays> res = std::make_shared<PersDiagramArrays>();
+	DiagramKey key = diagramKey(data, type, dims, pers_thd, input_file_info.hom_dim_mask);
+	if (!cache.find(key, *res)){
+		if (type == 'd')
+			runArrays(input_file_info, dims, static_cast<double *>(const_cast<void *>(data)), pers_thd, *res);
+		else
+			runArrays(input_file_info, dims, static_cast<float *>(const_cast<void *>(data)), pers_thd, *res);
+		cache.insert(key, *res);
+	}
+	DebuggerClass::finish();
+	return res;
+}
+
+py::dict cachedArrays(DiagramCache &cache, py::object entries, std::vector<int> dims, double pers_thd, std::vector<int> hom_dims ) {
+	return arraysToDict(cachedDiagram(cache, entries, dims, pers_thd, hom_dims));
+}
+
+// The rows of cubePers.
+std::vector<std::vector<double> > cachedRows(DiagramCache &cache, py::object entries, std::vector<int> dims, double pers_thd, std::vector<int> hom_dims ) {
+	std::shared_ptr<PersDiagramArrays> res = cachedDiagram(cache, entries, dims, pers_thd, hom_dims);
+	int dim = res->dim;
+	std::vector<std::vector<double> > rows(res->hom_dim.size(), std::vector<double>(2 * dim + 4));
+	for (size_t i = 0; i < rows.size(); i++){
+		rows[i][0] = res->hom_dim[i];
+		rows[i][1] = res->birth[i];
+		rows[i][2] = res->death[i];
+		rows[i][3] = res->persistence[i];
+		for (int k = 0; k < dim; k++){
+			rows[i][4 + k] = res->birth_coords[i * dim + k];
+			rows[i][4 + dim + k] = res->death_coords[i * dim + k];
+		}
+	}
+	return rows;
+}
+
+template<typename ValueT, typename MapT>
+TopoLossPatchResult topoLossHeld(const HeldImage &lh, const HeldImage &gt, HeldImage &weight, HeldImage &ref, int oy, int ox, const TopoLossParams &params) {
+	MapT *w = static_cast<MapT *>(weight.data) + size_t(oy) * weight.dims[1] + ox;
+	MapT *r = static_cast<MapT *>(ref.data) + size_t(oy) * weight.dims[1] + ox;
+	return topoLossPatch(static_cast<const ValueT *>(lh.data), static_cast<const ValueT *>(gt.data), lh.dims[1],
+		lh.dims[0], lh.dims[1], w, r, weight.dims[1], params);
+}
+
+// The per-patch part of getTopoLoss (see TopoLoss.h): diagrams of the 2D 'likelihood' and 'gt'
+// patches, their matching, and the critical points written into 'weight_map' and 'ref_map'
+// with the patch's first pixel at 'offset' (row, column). The maps are whole images, so a
+// patch can be written in place; they are writable buffers or DLPack capsules of float32 or
+// float64, the patches C-contiguous float32/float64 arrays of the same type.
+// Returns a dict of 'skipped' (constant patch or no pairs), 'fixed' and 'removed' (dots pushed
+// to (0, 1) or to the diagonal) and 'loss' (sum of the squared forces on the diagram).
+py::dict topoLossMaps(py::object likelihood, py::object gt, py::object weight_map, py::object ref_map, double pers_thresh, double pers_thresh_perfect, std::vector<int> offset) {
+	HeldImage lh, g, weight, ref;
+	std::vector<int> dims, gt_dims;
+	holdImage(likelihood, lh, dims, "topoLossMaps: likelihood");
+	holdImage(gt, g, gt_dims, "topoLossMaps: gt");
+	holdArray(weight_map, weight, true, "topoLossMaps: weight_map");
+	holdArray(ref_map, ref, true, "topoLossMaps: ref_map");
+	if (dims.size() != 2 || gt_dims != dims || g.type != lh.type)
+		throw std::runtime_error("topoLossMaps: likelihood and gt have to be 2D patches of the same shape and type");
+	if (weight.dims.size() != 2 || weight.dims != ref.dims || weight.type != ref.type || (weight.type != 'd' && weight.type != 'f'))
+		throw std::runtime_error("topoLossMaps: the maps have to be 2D float32/float64 arrays of the same shape and type");
+	if (offset.size() != 2 || offset[0] < 0 || offset[1] < 0
+		|| offset[0] + dims[0] > weight.dims[0] || offset[1] + dims[1] > weight.dims[1])
+		throw std::runtime_error("topoLossMaps: the patch does not fit into the maps at this offset");
+
+	string lfile = "log.txt";	
+	string efile = "error.txt";	
+	DebuggerClass::init( true, lfile, efile );
+	TopoLossParams params(pers_thresh, pers_thresh_perfect);
+	TopoLossPatchResult res;
+	if (lh.type == 'd')
+		res = weight.type == 'd' ? topoLossHeld<double, double>(lh, g, weight, ref, offset[0], offset[1], params)
+			: topoLossHeld<double, float>(lh, g, weight, ref, offset[0], offset[1], params);
+	else
+		res = weight.type == 'd' ? topoLossHeld<float, double>(lh, g, weight, ref, offset[0], offset[1], params)
+			: topoLossHeld<float, float>(lh, g, weight, ref, offset[0], offset[1], params);
+	DebuggerClass::finish();
+
+	py::dict d;
+	d[py::str("skipped")] = py::bool_(res.skipped);
+	d[py::str("fixed")] = py::int_(res.fixed);
+	d[py::str("removed")] = py::int_(res.removed);
+	d[py::str("loss")] = py::float_(res.loss);
+	return d;
+}
+
+// The images are the last 'dim' axes of the held arrays, a first extra axis numbers them.
+template<int dim, typename ValueT, typename MapT>
+void topoLossTilesHeld(const HeldImage &lh, const HeldImage &gt, HeldImage &weight, HeldImage &ref, int n, int tile, int stride,
+	const TopoLossDims &dims, bool global_pairs, ThreadPool &pool, std::vector<TopoLossImageResult> &out) {
+	const int *shape = &lh.dims[lh.dims.size() - dim];
+	topoLossTiles<dim>(static_cast<const ValueT *>(lh.data), static_cast<const ValueT *>(gt.data), n, shape, tile, stride,
+		static_cast<MapT *>(weight.data), static_cast<MapT *>(ref.data), dims, global_pairs, pool, out);
+}
+
+template<int dim>
+void topoLossTilesTyped(const HeldImage &lh, const HeldImage &gt, HeldImage &weight, HeldImage &ref, int n, int tile, int stride,
+	const TopoLossDims &dims, bool global_pairs, int num_threads, std::vector<TopoLossImageResult> &out) {
+	size_t num_tiles = n;
+	for (size_t k = lh.dims.size() - dim; k < lh.dims.size(); k++)
+		num_tiles *= (lh.dims[k] + stride - 1) / stride;
+	ThreadPool pool(std::min<size_t>(num_threads > 0 ? num_threads : ThreadPool::defaultThreads(), std::max<size_t>(num_tiles, 1)));
+	if (lh.type == 'd')
+		if (weight.type == 'd')
+			topoLossTilesHeld<dim, double, double>(lh, gt, weight, ref, n, tile, stride, dims, global_pairs, pool, out);
+		else
+			topoLossTilesHeld<dim, double, float>(lh, gt, weight, ref, n, tile, stride, dims, global_pairs, pool, out);
+	else
+		if (weight.type == 'd')
+			topoLossTilesHeld<dim, float, double>(lh, gt, weight, ref, n, tile, stride, dims, global_pairs, pool, out);
+		else
+			topoLossTilesHeld<dim, float, float>(lh, gt, weight, ref, n, tile, stride, dims, global_pairs, pool, out);
+}
+
+// getTopoLoss of a whole image (2D) or of a batch of images (3D, N x H x W) in one call: the
+// topo_size x topo_size tiles, starting every 'stride' pixels (0: topo_size, as getTopoLoss),
+// are computed on 'num_threads' threads (0: one per core) without the GIL, and the critical
+// points are written into 'weight_map' and 'ref_map', which have the shape of 'likelihood'
+// and are zeroed first. A stride above topo_size leaves gaps between the tiles, where
+// nothing is penalized. Arrays are as for topoLossMaps. With 'global_pairs', each image's
+// diagrams are computed once and their pairs handed to the tiles holding them (see
+// topoLossTiles in TopoLoss.h), instead of computing every tile on its own.
+// Returns a dict of 'tiles', 'skipped', 'fixed', 'removed' and 'loss' (sums over the tiles),
+// with one value per image in lists for a batch.
+py::dict topoLossTiled(py::object likelihood, py::object gt, py::object weight_map, py::object ref_map, int topo_size, int stride,
+	double pers_thresh, double pers_thresh_perfect, int num_threads, bool global_pairs) {
+	HeldImage lh, g, weight, ref;
+	std::vector<int> dims, gt_dims;
+	holdImage(likelihood, lh, dims, "topoLossTiled: likelihood");
+	holdImage(gt, g, gt_dims, "topoLossTiled: gt");
+	holdArray(weight_map, weight, true, "topoLossTiled: weight_map");
+	holdArray(ref_map, ref, true, "topoLossTiled: ref_map");
+	if ((dims.size() != 2 && dims.size() != 3) || gt_dims != dims || g.type != lh.type)
+		throw std::runtime_error("topoLossTiled: likelihood and gt have to be 2D images or 3D batches of the same shape and type");
+	if (weight.dims != dims || ref.dims != dims || weight.type != ref.type || (weight.type != 'd' && weight.type != 'f'))
+		throw std::runtime_error("topoLossTiled: the maps have to be float32/float64 arrays of the shape of likelihood");
+	if (topo_size < 1 || stride < 0)
+		throw std::runtime_error("topoLossTiled: topo_size has to be positive and stride not negative");
+	if (stride == 0)
+		stride = topo_size;
+	int n = dims.size() == 3 ? dims[0] : 1;
+
+	string lfile = "log.txt";	
+	string efile = "error.txt";	
+	DebuggerClass::init( true, lfile, efile );
+	TopoLossDims hom_dims(TopoLossParams(pers_thresh, pers_thresh_perfect));
+	std::vector<TopoLossImageResult> res;
+	{
+		py::gil_scoped_release release;
+		topoLossTilesTyped<2>(lh, g, weight, ref, n, topo_size, stride, hom_dims, global_pairs, num_threads, res);
+	}
+	DebuggerClass::finish();
+
+	py::dict d;
+	if (dims.size() == 2){
+		d[py::str("tiles")] = py::int_(res[0].tiles);
+		d[py::str("skipped")] = py::int_(res[0].skipped);
+		d[py::str("fixed")] = py::int_(res[0].fixed);
+		d[py::str("removed")] = py::int_(res[0].removed);
+		d[py::str("loss")] = py::float_(res[0].loss);
+		return d;
+	}
+	py::list tiles, skipped, fixed, removed, loss;
+	for (int i = 0; i < n; i++){
+		tiles.append(py::int_(res[i].tiles));
+		skipped.append(py::int_(res[i].skipped));
+		fixed.append(py::int_(res[i].fixed));
+		removed.append(py::int_(res[i].removed));
+		loss.append(py::float_(res[i].loss));
+	}
+	d[py::str("tiles")] = tiles;
+	d[py::str("skipped")] = skipped;
+	d[py::str("fixed")] = fixed;
+	d[py::str("removed")] = removed;
+	d[py::str("loss")] = loss;
+	return d;
+}
+
+// topoLossTiled for 3D volumes (D x H x W) or batches of them (N x D x H x W), e.g. electron
+// microscopy stacks: topo_size^3 tiles, whose diagrams are matched for each of 'hom_dims'
+// (0: components, 1: tunnels, 2: cavities) on its own. 'pers_thresh' and 'pers_thresh_perfect'
+// hold one threshold per entry of 'hom_dims', or one for all of them.
+// Returns the dict of topoLossTiled, with 'loss_by_dim' the part of 'loss' of dimensions 0,
+// 1 and 2 (one such list per volume for a batch).
+py::dict topoLossTiled3D(py::object likelihood, py::object gt, py::object weight_map, py::object ref_map, int topo_size, int stride,
+	std::vector<int> hom_dims, std::vector<double> pers_thresh, std::vector<double> pers_thresh_perfect, int num_threads, bool global_pairs) {
+	HeldImage lh, g, weight, ref;
+	std::vector<int> dims, gt_dims;
+	holdImage(likelihood, lh, dims, "topoLossTiled3D: likelihood");
+	holdImage(gt, g, gt_dims, "topoLossTiled3D: gt");
+	holdArray(weight_map, weight, true, "topoLossTiled3D: weight_map");
+	holdArray(ref_map, ref, true, "topoLossTiled3D: ref_map");
+	if ((dims.size() != 3 && dims.size() != 4) || gt_dims != dims || g.type != lh.type)
+		throw std::runtime_error("topoLossTiled3D: likelihood and gt have to be 3D volumes or 4D batches of the same shape and type");
+	if (weight.dims != dims || ref.dims != dims || weight.type != ref.type || (weight.type != 'd' && weight.type != 'f'))
+		throw std::runtime_error("topoLossTiled3D: the maps have to be float32/float64 arrays of the shape of likelihood");
+	if (topo_size < 1 || stride < 0)
+		throw std::runtime_error("topoLossTiled3D: topo_size has to be positive and stride not negative");
+	if (hom_dims.empty()
+		|| (pers_thresh.size() != 1 && pers_thresh.size() != hom_dims.size())
+		|| (pers_thresh_perfect.size() != 1 && pers_thresh_perfect.size() != hom_dims.size()))
+		throw std::runtime_error("topoLossTiled3D: pers_thresh and pers_thresh_perfect need one value, or one per entry of hom_dims");
+	TopoLossDims loss_dims;
+	loss_dims.mask = 0;
+	for (size_t i = 0; i < hom_dims.size(); i++){
+		int k = hom_dims[i];
+		if (k < 0 || k > 2 || loss_dims.has(k))
+			throw std::runtime_error("topoLossTiled3D: hom_dims have to be distinct values among 0, 1 and 2");
+		loss_dims.mask |= 1u << k;
+		loss_dims.params[k] = TopoLossParams(pers_thresh[pers_thresh.size() > 1 ? i : 0],
+			pers_thresh_perfect[pers_thresh_perfect.size() > 1 ? i : 0]);
+	}
+	if (stride == 0)
+		stride = topo_size;
+	int n = dims.size() == 4 ? dims[0] : 1;
+
+	string lfile = "log.txt";	
+	string efile = "error.txt";	
+	DebuggerClass::init( true, lfile, efile );
+	std::vector<TopoLossImageResult> res;
+	{
+		py::gil_scoped_release release;
+		topoLossTilesTyped<3>(lh, g, weight, ref, n, topo_size, stride, loss_dims, global_pairs, num_threads, res);
+	}
+	DebuggerClass::finish();
+
+	py::list tiles, skipped, fixed, removed, loss, loss_by_dim;
+	for (int i = 0; i < n; i++){
+		tiles.append(py::int_(res[i].tiles));
+		skipped.append(py::int_(res[i].skipped));
+		fixed.append(py::int_(res[i].fixed));
+		removed.append(py::int_(res[i].removed));
+		loss.append(py::float_(res[i].loss));
+		py::list by_dim;
+		for (int k = 0; k < 3; k++)
+			by_dim.append(py::float_(res[i].dim_loss[k]));
+		loss_by_dim.append(by_dim);
+	}
+	py::dict d;
+	if (dims.size() == 3){
+		d[py::str("tiles")] = tiles[0];
+		d[py::str("skipped")] = skipped[0];
+		d[py::str("fixed")] = fixed[0];
+		d[py::str("removed")] = removed[0];
+		d[py::str("loss")] = loss[0];
+		d[py::str("loss_by_dim")] = loss_by_dim[0];
+		return d;
+	}
+	d[py::str("tiles")] = tiles;
+	d[py::str("skipped")] = skipped;
+	d[py::str("fixed")] = fixed;
+	d[py::str("removed")] = removed;
+	d[py::str("loss")] = loss;
+	d[py::str("loss_by_dim")] = loss_by_dim;
+	return d;
+}
+
+// Frees the buffers kept for the next computations (see PersistenceWorkspace.h), e.g.
+// after the last of many large images; returns how many workspaces were freed.
+int releaseWorkspaces() {
+	return PersistenceWorkspacePool::shared().clear();
+}
+
+// cubePersArrays for each of 'images' (float32/float64 buffers in C order, e.g. NumPy arrays,
+// or DLPack capsules of CPU tensors, with their shape as dims), computed on 'num_threads' threads (0: one per core) with the GIL
+// released. Returns one dict of arrays per image, in order.
+py::list cubePersBatch(py::list images, double pers_thd, std::vector<int> hom_dims, int num_threads) {
+	size_t n = images.size();
+	std::vector<HeldImage> held(n);
+	for (size_t i = 0; i < n; i++){
+		py::object item = images[i];
+		std::vector<int> dims;
+		holdImage(item, held[i], dims, "cubePersBatch");
+	}
+
+	string lfile = "log.txt";	
+	string efile = "error.txt";	
+	DebuggerClass::init( true, lfile, efile );
+
+	std::vector< std::shared_ptr<PersDiagramArrays> > results(n);
+	std::vector<string> errors(n);
+	{
+		py::gil_scoped_release release;
+		ThreadPool pool(std::min<int>(num_threads > 0 ? num_threads : ThreadPool::defaultThreads(), std::max<size_t>(n, 1)));
+		for (size_t i = 0; i < n; i++)
+			pool.submit([&, i](){
+				try {
+					InputFileInfo info(held[i].dims.size());
+					setHomologyDims(info, hom_dims);
+					info.allow_pipeline = false;
+					results[i] = std::make_shared<PersDiagramArrays>();
+					if (held[i].type == 'd')
+						runArrays(info, held[i].dims, static_cast<double *>(held[i].data), pers_thd, *results[i]);
+					else
+						runArrays(info, held[i].dims, static_cast<float *>(held[i].data), pers_thd, *results[i]);
+				} catch (const std::exception &e) {
+					errors[i] = e.what();
+				}
+			});
+		pool.wait();
+	}
+
+	DebuggerClass::finish();
+
+	py::list out;
+	for (size_t i = 0; i < n; i++){
+		if (!errors[i].empty())
+			throw std::runtime_error("cubePersBatch: image " + std::to_string(i) + ": " + errors[i]);
+		out.append(arraysToDict(results[i]));
+	}
+	return out;
+}
+
+// A PersistenceQueue for Python. The queue is shared with nothing but the futures' weak
+// references, so it goes (cancelling what has not started) when the Python object does.
+struct QueueHandle {
+	std::shared_ptr<PersistenceQueue> queue;
+
+	QueueHandle(int num_threads, int max_pending, bool keep_completed)
+		: queue(std::make_shared<PersistenceQueue>(num_threads, max_pending, keep_completed)) {
+		string lfile = "log.txt";	
+		string efile = "error.txt";	
+		DebuggerClass::init( true, lfile, efile );
+	}
+	~QueueHandle() {
+		// the running jobs do not need the GIL, other Python threads may go on meanwhile
+		py::gil_scoped_release release;
+		queue.reset();
+	}
+};
+
+// A job submitted to a QueueHandle.
+struct PersistenceFuture {
+	std::shared_ptr<PersistenceJob> job;
+	std::weak_ptr<PersistenceQueue> queue;
+};
+
+// The image is copied, so the caller may overwrite its array as soon as submit() returns.
+template<typename ValueT>
+std::function<void(PersDiagramArrays &)> queuedImage(const ValueT *data, std::vector<int> dims, double pers_thd, std::vector<int> hom_dims) {
+	size_t n = 1;
+	for (size_t i = 0; i < dims.size(); i++)
+		n *= dims[i];
+	std::shared_ptr< std::vector<ValueT> > image = std::make_shared< std::vector<ValueT> >(data, data + n);
+	return [image, dims, pers_thd, hom_dims](PersDiagramArrays &out){
+		InputFileInfo info(dims.size());
+		setHomologyDims(info, hom_dims);
+		info.allow_pipeline = false;
+		runArrays(info, dims, &(*image)[0], pers_thd, out);
+	};
+}
+
+// Queues the persistence of 'entries' (a float32/float64 buffer in C order or a DLPack capsule,
+// as for cubePers). If 'max_pending' jobs are already queued or running, waits for one to finish (with the GIL
+// released), or returns None if 'block' is false.
+py::object queueSubmit(QueueHandle &q, py::object entries, std::vector<int> dims, double pers_thd, std::vector<int> hom_dims, bool block) {
+	std::function<void(PersDiagramArrays &)> compute;
+	{
+		HeldImage h;
+		holdImage(entries, h, dims, "PersistenceQueue.submit");
+		if (h.type == 'd')
+			compute = queuedImage(static_cast<const double *>(h.data), dims, pers_thd, hom_dims);
+		else
+			compute = queuedImage(static_cast<const float *>(h.data), dims, pers_thd, hom_dims);
+	}
+
+	std::shared_ptr<PersistenceJob> job;
+	{
+		py::gil_scoped_release release;
+		job = q.queue->submit(compute, block);
+	}
+	if (!job)
+		return py::object(Py_None, true);
+	return py::cast(new PersistenceFuture{job, q.queue}, py::return_value_policy::take_ownership);
+}
+
+// The next finished future, in the order they finished, or None after 'timeout' seconds
+// (negative: waits for ever). Every job is returned once, also when it has its own future.
+// Only for a queue made with keep_completed=True, which holds every finished job until then.
+py::object queueNextCompleted(QueueHandle &q, double timeout) {
+	if (!q.queue->keepsCompleted())
+		throw std::runtime_error("PersistenceQueue.next_completed: the queue was made with keep_completed=False");
+	std::shared_ptr<PersistenceJob> job;
+	{
+		py::gil_scoped_release release;
+		job = q.queue->nextCompleted(timeout);
+	}
+	if (!job)
+		return py::object(Py_None, true);
+	return py::cast(new PersistenceFuture{job, q.queue}, py::return_value_policy::take_ownership);
+}
+
+// The dict of arrays of cubePersArrays. Waits at most 'timeout' seconds (negative: for ever)
+// with the GIL released; raises if the job timed out, failed or was cancelled.
+py::dict futureResult(PersistenceFuture &f, double timeout) {
+	bool finished;
+	{
+		py::gil_scoped_release release;
+		finished = f.job->wait(timeout);
+	}
+	if (!finished)
+		throw std::runtime_error("Future.result: timed out");
+	switch (f.job->getState())
+	{
+	case PersistenceJob::Cancelled:
+		throw std::runtime_error("Future.result: the job was cancelled");
+	case PersistenceJob::Failed:
+		throw std::runtime_error("Future.result: " + f.job->error);
+	default:
+		return arraysToDict(f.job->result);
+	}
+}
+
+bool futureCancel(PersistenceFuture &f) {
+	std::shared_ptr<PersistenceQueue> queue = f.queue.lock();
+	return queue && queue->cancel(f.job);
+}
+
+// Same as cubePers, but the state of the previous call for 'image_id' is reused (see WarmStart.h).
+std::vector<std::vector<double> > warmCubePers(PersistenceWarmStart &warm, long long image_id, std::vector< double > &entries, std::vector<int> dims, double pers_thd, std::vector<int> hom_dims ) {
+	string lfile = "log.txt";	
+	string efile = "error.txt";	
+	DebuggerClass::init( true, lfile, efile );
+
+	InputFileInfo input_file_info(dims.size());
+	setHomologyDims(input_file_info, hom_dims);
+
+	switch(input_file_info.dimension)
+	{
+	case 1:
+		return InputRunner<1>::run_warm(warm, image_id, input_file_info, dims, entries, pers_thd);
+	case 2:
+		return InputRunner<2>::run_warm(warm, image_id, input_file_info, dims, entries, pers_thd);
+	case 3:
+		return InputRunner<3>::run_warm(warm, image_id, input_file_info, dims, entries, pers_thd);
+	case 4:
+		return InputRunner<4>::run_warm(warm, image_id, input_file_info, dims, entries, pers_thd);
+        default:
+                assert(false);
+	}
+	return std::vector<std::vector<double> >();
+}
+
 PYBIND11_PLUGIN(PersistencePython) {
         py::module m("PersistencePython", "python binding for persistence computation (cubical complex)");
 
 //    m.def("kw_func4", &kw_func4, py::arg("myList") = list);
-    m.def("cubePers", &cubePers);
+    // tried first, so that arrays are not converted to lists
+    m.def("cubePers", &cubePersCapsule, py::arg("entries"), py::arg("dims"), py::arg("pers_thd"), py::arg("hom_dims") = std::vector<int>(), py::arg("binary") = false);
+    m.def("cubePers", &cubePersBuffer, py::arg("entries"), py::arg("dims"), py::arg("pers_thd"), py::arg("hom_dims") = std::vector<int>(), py::arg("binary") = false);
+    m.def("cubePers", &cubePers, py::arg("entries"), py::arg("dims"), py::arg("pers_thd"), py::arg("hom_dims") = std::vector<int>(), py::arg("binary") = false);
+
+    py::class_<PairColumn>(m, "PairColumn")
+        .def_buffer([](PairColumn &c) -> py::buffer_info {
+            if (!c.cols)
+                return py::buffer_info(c.data, c.itemsize, c.format, 1, { c.rows }, { c.itemsize });
+            return py::buffer_info(c.data, c.itemsize, c.format, 2, { c.rows, c.cols }, { c.itemsize * c.cols, c.itemsize });
+        })
+        .def("__len__", [](const PairColumn &c) { return c.rows; });
+
+    m.def("cubePersArrays", &cubePersArraysCapsule, py::arg("entries"), py::arg("dims"), py::arg("pers_thd"), py::arg("hom_dims") = std::vector<int>(), py::arg("binary") = false);
+    m.def("cubePersArrays", &cubePersArraysBuffer, py::arg("entries"), py::arg("dims"), py::arg("pers_thd"), py::arg("hom_dims") = std::vector<int>(), py::arg("binary") = false);
+    m.def("cubePersArrays", &cubePersArrays, py::arg("entries"), py::arg("dims"), py::arg("pers_thd"), py::arg("hom_dims") = std::vector<int>(), py::arg("binary") = false);
+
+    m.def("cubePersMultiRes", &cubePersMultiRes, py::arg("entries"), py::arg("dims"), py::arg("pers_thd"), py::arg("levels") = 2, py::arg("hom_dims") = std::vector<int>());
+
+    m.def("cubePersArraysInto", &cubePersArraysInto, py::arg("entries"), py::arg("dims"), py::arg("pers_thd"), py::arg("out"), py::arg("hom_dims") = std::vector<int>());
+
+    m.def("topoLossMaps", &topoLossMaps, py::arg("likelihood"), py::arg("gt"), py::arg("weight_map"), py::arg("ref_map"),
+        py::arg("pers_thresh") = 0.03, py::arg("pers_thresh_perfect") = 0.99, py::arg("offset") = std::vector<int>(2, 0));
+
+    m.def("topoLossTiled", &topoLossTiled, py::arg("likelihood"), py::arg("gt"), py::arg("weight_map"), py::arg("ref_map"),
+        py::arg("topo_size") = 100, py::arg("stride") = 0, py::arg("pers_thresh") = 0.03, py::arg("pers_thresh_perfect") = 0.99,
+        py::arg("num_threads") = 0, py::arg("global_pairs") = false);
+    m.def("topoLossTiled3D", &topoLossTiled3D, py::arg("likelihood"), py::arg("gt"), py::arg("weight_map"), py::arg("ref_map"),
+        py::arg("topo_size") = 100, py::arg("stride") = 0, py::arg("hom_dims") = std::vector<int>{0, 1, 2},
+        py::arg("pers_thresh") = std::vector<double>(1, 0.03), py::arg("pers_thresh_perfect") = std::vector<double>(1, 0.99),
+        py::arg("num_threads") = 0, py::arg("global_pairs") = false);
+
+    m.def("cubePersBatch", &cubePersBatch, py::arg("images"), py::arg("pers_thd"), py::arg("hom_dims") = std::vector<int>(), py::arg("num_threads") = 0);
+    m.def("releaseWorkspaces", &releaseWorkspaces);
+
+    py::class_<DiagramCache>(m, "DiagramCache")
+        .def(py::init<size_t, const std::string &, size_t>(), py::arg("max_bytes") = (size_t)256 << 20, py::arg("path") = std::string(), py::arg("max_file_bytes") = (size_t)0)
+        .def("cubePers", &cachedRows, py::arg("entries"), py::arg("dims"), py::arg("pers_thd"), py::arg("hom_dims") = std::vector<int>())
+        .def("cubePersArrays", &cachedArrays, py::arg("entries"), py::arg("dims"), py::arg("pers_thd"), py::arg("hom_dims") = std::vector<int>())
+        .def("clear", &DiagramCache::clear)
+        .def("__len__", &DiagramCache::size)
+        .def_property_readonly("memory_bytes", &DiagramCache::memoryBytes)
+        .def_property_readonly("hits", &DiagramCache::hitCount)
+        .def_property_readonly("file_hits", &DiagramCache::fileHitCount)
+        .def_property_readonly("misses", &DiagramCache::missCount)
+        .def_property_readonly("has_file", &DiagramCache::hasFile);
+
+    py::class_<QueueHandle>(m, "PersistenceQueue")
+        .def(py::init<int, int, bool>(), py::arg("num_threads") = 0, py::arg("max_pending") = 0, py::arg("keep_completed") = false)
+        .def("submit", &queueSubmit, py::arg("entries"), py::arg("dims"), py::arg("pers_thd"), py::arg("hom_dims") = std::vector<int>(), py::arg("block") = true)
+        .def("next_completed", &queueNextCompleted, py::arg("timeout") = -1.0)
+        .def("__len__", [](QueueHandle &q) { return q.queue->pendingJobs(); })
+        .def_property_readonly("num_threads", [](QueueHandle &q) { return q.queue->threads(); })
+        .def_property_readonly("max_pending", [](QueueHandle &q) { return q.queue->maxPending(); });
+
+    py::class_<PersistenceFuture>(m, "Future")
+        .def("result", &futureResult, py::arg("timeout") = -1.0)
+        .def("done", [](PersistenceFuture &f) { return f.job->getState() != PersistenceJob::Queued && f.job->getState() != PersistenceJob::Running; })
+        .def("cancelled", [](PersistenceFuture &f) { return f.job->getState() == PersistenceJob::Cancelled; })
+        .def("cancel", &futureCancel)
+        .def_property_readonly("id", [](PersistenceFuture &f) { return f.job->id; });
+
+    py::class_<PersistenceWarmStart>(m, "WarmStart")
+        .def(py::init<bool>(), py::arg("keep_reduction") = true)
+        .def("cubePers", &warmCubePers, py::arg("image_id"), py::arg("entries"), py::arg("dims"), py::arg("pers_thd"), py::arg("hom_dims") = std::vector<int>())
+        .def("forget", &PersistenceWarmStart::forget, py::arg("image_id"))
+        .def("clear", &PersistenceWarmStart::clear)
+        .def("__len__", &PersistenceWarmStart::size)
+        .def_property_readonly("last_reused", &PersistenceWarmStart::lastReused);
+
+    py::class_<PersistenceVineyard>(m, "Vineyard")
+        .def(py::init<const std::vector<double> &, const std::vector<int> &>(), py::arg("entries"), py::arg("dims"))
+        .def("update", &PersistenceVineyard::update, py::arg("entries"), py::arg("max_swaps") = -1)
+        .def("pairs", &PersistenceVineyard::pairs, py::arg("pers_thd") = -1.0)
+        .def_property_readonly("last_swaps", &PersistenceVineyard::lastSwaps)
+        .def_property_readonly("last_transpositions", &PersistenceVineyard::lastTranspositions)
+        .def_property_readonly("last_switches", &PersistenceVineyard::lastSwitches)
+        .def_property_readonly("last_recomputed", &PersistenceVineyard::lastRecomputed);
     return m.ptr();
 }
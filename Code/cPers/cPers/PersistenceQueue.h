@@ -0,0 +1,216 @@
+#ifndef INCLUDED_PERSISTENCE_QUEUE_H
+#define INCLUDED_PERSISTENCE_QUEUE_H
+
+// Persistence computed in the background: jobs are submitted to a pool that lives as long
+// as the queue, and are collected through their handle or in the order they finish.
+// The number of jobs queued or running is bounded, so a producer that is faster than the
+// pool is held back (or told so) instead of piling up images.
+// A job that has not started yet can be cancelled.
+
+#include <memory>
+#include <algorithm>
+#include <chrono>
+
+#include "ThreadPool.h"
+#include "PersistentPair.h"
+
+struct PersistenceJob
+{
+	enum State { Queued, Running, Done, Failed, Cancelled };
+
+	PersistenceJob(long long id, const std::function<void(PersDiagramArrays &)> &compute)
+		: id(id), state(Queued), compute(compute)
+	{}
+
+	bool finished() const
+	{
+		return state == Done || state == Failed || state == Cancelled;
+	}
+
+	// Waits until the job is finished; a negative timeout waits for ever.
+	bool wait(double timeout_seconds)
+	{
+		std::unique_lock<std::mutex> lock(m);
+		if (timeout_seconds < 0){
+			changed.wait(lock, [this](){ return finished(); });
+			return true;
+		}
+		return changed.wait_for(lock, std::chrono::duration<double>(timeout_seconds), [this](){ return finished(); });
+	}
+
+	State getState()
+	{
+		std::lock_guard<std::mutex> lock(m);
+		return state;
+	}
+
+	const long long id;
+	State state;
+	string error;
+	std::shared_ptr<PersDiagramArrays> result;
+	std::function<void(PersDiagramArrays &)> compute;
+
+	std::mutex m;
+	std::condition_variable changed;
+};
+
+class PersistenceQueue
+{
+public:
+	// max_pending 0: twice the number of threads. Finished jobs are kept for nextCompleted()
+	// only with 'keep_completed', otherwise they are only reachable through their handle.
+	PersistenceQueue(int threads = 0, int max_pending = 0, bool keep_completed = false)
+		: max_pending(max_pending > 0 ? max_pending : 2 * (threads > 0 ? threads : ThreadPool::defaultThreads())),
+		keep_completed(keep_completed), pending(0), next_id(0), pool(threads)
+	{}
+
+	// Cancels what has not started and waits for the running jobs.
+	~PersistenceQueue()
+	{
+		std::unique_lock<std::mutex> lock(m);
+		std::deque< std::shared_ptr<PersistenceJob> > not_started;
+		not_started.swap(queued);
+		for (size_t i = 0; i < not_started.size(); i++)
+			cancelLocked(not_started[i]);
+		// the pool is the last member: its workers finish the running jobs before anything else goes
+	}
+
+	// Returns NULL if the queue is full and 'block' is false.
+	std::shared_ptr<PersistenceJob> submit(const std::function<void(PersDiagramArrays &)> &compute, bool block)
+	{
+		std::unique_lock<std::mutex> lock(m);
+		if (pending >= max_pending){
+			if (!block)
+				return std::shared_ptr<PersistenceJob>();
+			slot_free.wait(lock, [this](){ return pending < max_pending; });
+		}
+		std::shared_ptr<PersistenceJob> job = std::make_shared<PersistenceJob>(next_id++, compute);
+		pending++;
+		queued.push_back(job);
+		lock.unlock();
+
+		pool.submit([this, job](){ run(job); });
+		return job;
+	}
+
+	// True if the job had not started and will not run.
+	bool cancel(const std::shared_ptr<PersistenceJob> &job)
+	{
+		std::lock_guard<std::mutex> lock(m);
+		return cancelLocked(job);
+	}
+
+	// The next finished job (done, failed or cancelled), in the order they finished;
+	// NULL if none finished within the timeout. Every job is returned once.
+	// Requires keep_completed.
+	std::shared_ptr<PersistenceJob> nextCompleted(double timeout_seconds)
+	{
+		std::unique_lock<std::mutex> lock(m);
+		if (timeout_seconds < 0)
+			job_finished.wait(lock, [this](){ return !completed.empty(); });
+		else if (!job_finished.wait_for(lock, std::chrono::duration<double>(timeout_seconds), [this](){ return !completed.empty(); }))
+			return std::shared_ptr<PersistenceJob>();
+		std::shared_ptr<PersistenceJob> job = completed.front();
+		completed.pop_front();
+		return job;
+	}
+
+	// jobs queued or running
+	size_t pendingJobs()
+	{
+		std::lock_guard<std::mutex> lock(m);
+		return pending;
+	}
+
+	int threads() const
+	{
+		return pool.size();
+	}
+
+	size_t maxPending() const
+	{
+		return max_pending;
+	}
+
+	bool keepsCompleted() const
+	{
+		return keep_completed;
+	}
+
+private:
+	PersistenceQueue(const PersistenceQueue &);
+	PersistenceQueue &operator=(const PersistenceQueue &);
+
+	void run(const std::shared_ptr<PersistenceJob> &job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m);
+			std::lock_guard<std::mutex> job_lock(job->m);
+			if (job->state != PersistenceJob::Queued)
+				return;		// cancelled
+			job->state = PersistenceJob::Running;
+			queued.erase(std::find(queued.begin(), queued.end(), job));
+		}
+
+		std::shared_ptr<PersDiagramArrays> result = std::make_shared<PersDiagramArrays>();
+		string error;
+		try {
+			job->compute(*result);
+		} catch (const std::exception &e) {
+			error = e.what();
+		}
+
+		{
+			std::lock_guard<std::mutex> job_lock(job->m);
+			job->compute = std::function<void(PersDiagramArrays &)>();
+			job->error = error;
+			if (error.empty())
+				job->result = result;
+			job->state = error.empty() ? PersistenceJob::Done : PersistenceJob::Failed;
+		}
+		job->changed.notify_all();
+		finish(job);
+	}
+
+	bool cancelLocked(const std::shared_ptr<PersistenceJob> &job)
+	{
+		{
+			std::lock_guard<std::mutex> job_lock(job->m);
+			if (job->state != PersistenceJob::Queued)
+				return false;
+			job->state = PersistenceJob::Cancelled;
+			job->compute = std::function<void(PersDiagramArrays &)>();
+		}
+		job->changed.notify_all();
+		std::deque< std::shared_ptr<PersistenceJob> >::iterator it = std::find(queued.begin(), queued.end(), job);
+		if (it != queued.end())
+			queued.erase(it);
+		if (keep_completed)
+			completed.push_back(job);
+		pending--;
+		slot_free.notify_one();
+		job_finished.notify_all();
+		return true;
+	}
+
+	void finish(const std::shared_ptr<PersistenceJob> &job)
+	{
+		std::lock_guard<std::mutex> lock(m);
+		if (keep_completed)
+			completed.push_back(job);
+		pending--;
+		slot_free.notify_one();
+		job_finished.notify_all();
+	}
+
+	const size_t max_pending;
+	const bool keep_completed;
+	size_t pending;
+	long long next_id;
+	std::deque< std::shared_ptr<PersistenceJob> > queued, completed;
+	std::mutex m;
+	std::condition_variable slot_free, job_finished;
+	ThreadPool pool;
+};
+
+#endif
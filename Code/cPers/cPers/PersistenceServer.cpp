@@ -0,0 +1,381 @@
+// Persistence server: computes cubical persistence for local clients (see PersistenceClient.py),
+// so that many trainer and data loader processes share one pool of threads instead of each
+// starting their own.
+//
+// Clients connect to a Unix domain socket and send requests one after another on the connection.
+// The image is not sent over the socket: the client writes it into a POSIX shared memory
+// object and sends its name, the server maps it read-only for the duration of the request.
+// All connections submit to the same PersistenceQueue, one thread per core the server may use.
+//
+// Request: a ServerRequest. Response: a ServerResponse followed by, if status is 0, the pairs
+// column by column (as cubePersArrays): n int32 homology dimensions, n float64 births, deaths
+// and persistence values, n*dim int32 birth and n*dim int32 death coordinates; otherwise
+// message_length bytes of error message. Everything is in the native byte order.
+#include <cmath>
+#include <vector>
+#include <map>
+#include <set>
+#include <list>
+#include <cassert>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <deque>
+#include <cstring>
+#include <ctime>
+#include <csignal>
+#include <cerrno>
+#include <blitz/array.h>
+#include <blitz/tinyvec-et.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace std;
+
+const int BIG_INT = 0x7FFFFFFF;	//be careful, could be too small compared to # of cubes
+typedef int CellNrType; // it could be long for really large inputs...
+
+#include "PersistenceIO.h"
+#include "Debugging.h"
+#include "GeneralFiltration.h"
+
+#include "InputRunner.h"
+
+#include "PersistentPair.h"
+#include "DataReaders.h"
+
+#include "PersistenceCalculator.h"
+#include "PersistenceCalcRunner.h"
+#include "PersistenceQueue.h"
+
+const char kRequestMagic[4] = {'P', 'Q', 'R', '1'};
+const char kResponseMagic[4] = {'P', 'Q', 'S', '1'};
+const int kMaxServerDims = 4;
+const int kShmNameLength = 64;
+
+struct ServerRequest
+{
+	char magic[4];
+	int32_t value_size;		// 8: float64, 4: float32
+	int32_t ndims;
+	int32_t dims[kMaxServerDims];
+	uint32_t hom_dim_mask;		// bit k: homology dimension k is wanted; all bits set: every one
+	int32_t reserved[2];		// keeps pers_thd aligned without implicit padding
+	double pers_thd;
+	char shm_name[kShmNameLength];	// "/name", NUL terminated; the image starts at offset 0
+};
+
+struct ServerResponse
+{
+	char magic[4];
+	int32_t status;			// 0: the pairs follow, otherwise an error message
+	int32_t dim;
+	int32_t reserved;
+	uint64_t num_pairs;
+	uint64_t message_length;
+};
+
+static_assert(sizeof(ServerRequest) == 112, "ServerRequest layout is part of the protocol");
+static_assert(sizeof(ServerResponse) == 32, "ServerResponse layout is part of the protocol");
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void requestStop(int)
+{
+	stop_requested = 1;
+}
+
+static bool readAll(int fd, void *buf, size_t n)
+{
+	char *p = static_cast<char *>(buf);
+	while (n > 0){
+		ssize_t r = recv(fd, p, n, 0);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return false;
+		p += r;
+		n -= r;
+	}
+	return true;
+}
+
+static bool writeAll(int fd, const void *buf, size_t n)
+{
+	const char *p = static_cast<const char *>(buf);
+	while (n > 0){
+		ssize_t r = send(fd, p, n, MSG_NOSIGNAL);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return false;
+		p += r;
+		n -= r;
+	}
+	return true;
+}
+
+template<typename T>
+static bool writeVector(int fd, const vector<T> &v)
+{
+	return v.empty() || writeAll(fd, &v[0], v.size() * sizeof(T));
+}
+
+// A shared memory object mapped read-only for one request.
+struct MappedImage
+{
+	void *data;
+	size_t length;
+
+	MappedImage() : data(MAP_FAILED), length(0) {}
+	~MappedImage()
+	{
+		if (data != MAP_FAILED)
+			munmap(data, length);
+	}
+
+	string map(const char *name, size_t needed)
+	{
+		int fd = shm_open(name, O_RDONLY, 0);
+		if (fd < 0)
+			return string("cannot open shared memory ") + name + ": " + strerror(errno);
+		struct stat st;
+		if (fstat(fd, &st) != 0 || (size_t)st.st_size < needed){
+			close(fd);
+			return string("shared memory ") + name + " is smaller than the image";
+		}
+		length = needed;
+		data = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (data == MAP_FAILED)
+			return string("cannot map shared memory ") + name + ": " + strerror(errno);
+		return string();
+	}
+};
+
+template<typename ValueT>
+void runArrays(InputFileInfo &info, std::vector<int> dims, ValueT *data, double pers_thd, PersDiagramArrays &out)
+{
+	PooledWorkspace ws;
+	switch(info.dimension)
+	{
+	case 1:
+		InputRunner<1>::run_arrays(info, dims, data, pers_thd, out, &ws->of<1>());
+		break;
+	case 2:
+		InputRunner<2>::run_arrays(info, dims, data, pers_thd, out, &ws->of<2>());
+		break;
+	case 3:
+		InputRunner<3>::run_arrays(info, dims, data, pers_thd, out, &ws->of<3>());
+		break;
+	case 4:
+		InputRunner<4>::run_arrays(info, dims, data, pers_thd, out, &ws->of<4>());
+		break;
+	default:
+		assert(false);
+	}
+}
+
+// Computes one request; an empty string on success, the error message otherwise.
+string serveRequest(PersistenceQueue &queue, const ServerRequest &req, PersDiagramArrays &out)
+{
+	if (req.ndims < 1 || req.ndims > kMaxServerDims)
+		return "the image must have 1 to 4 dimensions";
+	if (req.value_size != 8 && req.value_size != 4)
+		return "the image must be float64 or float32";
+	vector<int> dims(req.dims, req.dims + req.ndims);
+	size_t n = 1;
+	for (size_t i = 0; i < dims.size(); i++){
+		if (dims[i] < 1)
+			return "dims must be positive";
+		n *= dims[i];
+	}
+	// as setHomologyDims of the Python module
+	if (req.hom_dim_mask != ~0u)
+		for (int k = req.ndims; k < 32; k++)
+			if ((req.hom_dim_mask >> k) & 1u)
+				return "hom_dims: " + std::to_string(k) + " is not a homology dimension of a "
+					+ std::to_string(req.ndims) + "D image";
+	string name(req.shm_name, strnlen(req.shm_name, kShmNameLength));
+	if (name.size() == kShmNameLength || name.size() < 2 || name[0] != '/' || name.find('/', 1) != string::npos)
+		return "bad shared memory name";
+
+	MappedImage image;
+	string error = image.map(name.c_str(), n * req.value_size);
+	if (!error.empty())
+		return error;
+
+	const void *data = image.data;
+	int value_size = req.value_size;
+	unsigned hom_dim_mask = req.hom_dim_mask;
+	double pers_thd = req.pers_thd;
+	std::shared_ptr<PersistenceJob> job = queue.submit([=](PersDiagramArrays &res){
+		InputFileInfo info(dims.size());
+		info.hom_dim_mask = hom_dim_mask;
+		info.allow_pipeline = false;
+		if (value_size == 8)
+			runArrays(info, dims, static_cast<double *>(const_cast<void *>(data)), pers_thd, res);
+		else
+			runArrays(info, dims, static_cast<float *>(const_cast<void *>(data)), pers_thd, res);
+	}, true);
+	// the image stays mapped until the job is finished
+	job->wait(-1);
+	if (job->getState() != PersistenceJob::Done)
+		return job->error.empty() ? string("cancelled") : job->error;
+	out.dim = job->result->dim;
+	out.hom_dim.swap(job->result->hom_dim);
+	out.birth.swap(job->result->birth);
+	out.death.swap(job->result->death);
+	out.persistence.swap(job->result->persistence);
+	out.birth_coords.swap(job->result->birth_coords);
+	out.death_coords.swap(job->result->death_coords);
+	return string();
+}
+
+bool sendResponse(int fd, const string &error, const PersDiagramArrays &res)
+{
+	ServerResponse resp;
+	memset(&resp, 0, sizeof(resp));
+	memcpy(resp.magic, kResponseMagic, sizeof(resp.magic));
+	resp.status = error.empty() ? 0 : 1;
+	if (!error.empty()){
+		resp.message_length = error.size();
+		return writeAll(fd, &resp, sizeof(resp)) && writeAll(fd, error.data(), error.size());
+	}
+	resp.dim = res.dim;
+	resp.num_pairs = res.hom_dim.size();
+	return writeAll(fd, &resp, sizeof(resp))
+		&& writeVector(fd, res.hom_dim) && writeVector(fd, res.birth) && writeVector(fd, res.death)
+		&& writeVector(fd, res.persistence) && writeVector(fd, res.birth_coords) && writeVector(fd, res.death_coords);
+}
+
+// The open connections, so that a stopping server can wake up the threads reading them.
+struct Connections
+{
+	std::mutex m;
+	std::condition_variable closed;
+	std::set<int> fds;
+
+	void add(int fd)
+	{
+		std::lock_guard<std::mutex> lock(m);
+		fds.insert(fd);
+	}
+
+	void remove(int fd)
+	{
+		std::lock_guard<std::mutex> lock(m);
+		fds.erase(fd);
+		close(fd);
+		closed.notify_all();
+	}
+
+	void shutdownAll()
+	{
+		std::unique_lock<std::mutex> lock(m);
+		for (std::set<int>::iterator it = fds.begin(); it != fds.end(); ++it)
+			shutdown(*it, SHUT_RDWR);
+		closed.wait(lock, [this](){ return fds.empty(); });
+	}
+};
+
+void serveConnection(PersistenceQueue &queue, Connections &connections, int fd)
+{
+	ServerRequest req;
+	while (readAll(fd, &req, sizeof(req))){
+		if (memcmp(req.magic, kRequestMagic, sizeof(req.magic)) != 0){
+			OUTPUT_MSG("persistence server: bad request, closing the connection");
+			break;
+		}
+		PersDiagramArrays res;
+		string error = serveRequest(queue, req, res);
+		if (!error.empty())
+			OUTPUT_MSG("persistence server: " << error);
+		if (!sendResponse(fd, error, res))
+			break;
+	}
+	connections.remove(fd);
+}
+
+int main(int argc, const char* argv[]){
+
+	if (argc < 2)
+	{
+		std::cout << "usage: " << argv[0] << " socket_path [--threads N] [--max-pending N]" << std::endl;
+		return 1;
+	}
+
+	string socket_path = argv[1];
+	int threads = 0;
+	int max_pending = 0;
+	for (int i = 2; i < argc; i++)
+	{
+		string opt = argv[i];
+		if (opt != "--threads" && opt != "--max-pending")
+			std::cout << "unknown option " << opt << std::endl;
+		else if (i + 1 == argc)
+			std::cout << "missing value for " << opt << std::endl;
+		else if (opt == "--threads")
+			threads = atoi(argv[++i]);
+		else
+			max_pending = atoi(argv[++i]);
+	}
+
+	string lfile = "log.txt";
+	string efile = "error.txt";
+	DebuggerClass::init( false, lfile, efile );
+
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (socket_path.size() >= sizeof(addr.sun_path)){
+		std::cout << "socket path too long: " << socket_path << std::endl;
+		return 1;
+	}
+	strcpy(addr.sun_path, socket_path.c_str());
+
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(socket_path.c_str());
+	if (listen_fd < 0 || bind(listen_fd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 64) != 0){
+		std::cout << "cannot listen on " << socket_path << ": " << strerror(errno) << std::endl;
+		return 1;
+	}
+
+	signal(SIGINT, requestStop);
+	signal(SIGTERM, requestStop);
+	signal(SIGPIPE, SIG_IGN);
+
+	Connections connections;
+	{
+		PersistenceQueue queue(threads, max_pending);
+		std::cout << "persistence server on " << socket_path << ", " << queue.threads() << " threads" << std::endl;
+		OUTPUT_MSG("persistence server on " << socket_path << ", " << queue.threads() << " threads");
+
+		pollfd p = {listen_fd, POLLIN, 0};
+		while (!stop_requested){
+			if (poll(&p, 1, 200) <= 0)
+				continue;
+			int fd = accept(listen_fd, NULL, NULL);
+			if (fd < 0)
+				continue;
+			connections.add(fd);
+			std::thread(serveConnection, std::ref(queue), std::ref(connections), fd).detach();
+		}
+
+		close(listen_fd);
+		unlink(socket_path.c_str());
+		// the connection threads finish their current request before the queue goes
+		connections.shutdownAll();
+	}
+	std::cout << "persistence server stopped" << std::endl;
+	DebuggerClass::finish();
+	return 0;
+}
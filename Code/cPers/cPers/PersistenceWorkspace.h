@@ -0,0 +1,152 @@
+#ifndef INCLUDED_PERSISTENCE_WORKSPACE_H
+#define INCLUDED_PERSISTENCE_WORKSPACE_H
+
+// Buffers of calcPersistence kept from one computation to the next, for the many small
+// images of the same shape of batches, tiles and queues: the cell numbering, the birth and
+// low lists and the boundary columns are cleared but keep their capacity, so a computation
+// of a shape seen before allocates (almost) nothing.
+// A workspace is used by one computation at a time. The ones not in use wait in a
+// PersistenceWorkspacePool; PooledWorkspace takes one for the length of a scope.
+
+#include <vector>
+#include <tuple>
+#include <memory>
+#include <mutex>
+#include <blitz/array.h>
+
+template<int dim>
+struct PersistenceWorkspace
+{
+	typedef blitz::TinyVector<int, dim> Vertex;
+
+	vector<Vertex> vList;
+	blitz::Array<int, dim> filtration_order, max_value;	// of CubicalFiltration
+	vector< vector<int> > birth_lists, low_arrays;
+	vector<bool> will_be_cleared;
+	// per dimension: the columns of the last boundary matrix, handed back once reduced
+	vector< vector< MatrixListType > > columns;
+
+	PersistenceWorkspace() : shape(0) {}
+
+	// Empties the lists for a computation of an image of 'image_shape'. A new shape
+	// frees everything first, so that a workspace holds no more than the current image needs.
+	// 'keep_numbering' keeps the birth lists of the last computation, which a warm start renumbers.
+	void prepare(const blitz::TinyVector<int, dim> &image_shape, bool keep_numbering = false)
+	{
+		if (blitz::any(image_shape != shape)){
+			vector<Vertex>().swap(vList);
+			filtration_order.free();
+			max_value.free();
+			birth_lists.clear();
+			low_arrays.clear();
+			vector<bool>().swap(will_be_cleared);
+			columns.clear();
+			shape = image_shape;
+		}
+		birth_lists.resize(dim+1);
+		low_arrays.resize(dim+1);
+		columns.resize(dim+1);
+		for (int i = 0; i <= dim; i++){
+			if (!keep_numbering)
+				birth_lists[i].clear();
+			low_arrays[i].clear();
+		}
+	}
+
+private:
+	blitz::TinyVector<int, dim> shape;
+};
+
+// One workspace per image dimension, for callers that see images of any dimension.
+struct PersistenceWorkspaces
+{
+	std::tuple< PersistenceWorkspace<1>, PersistenceWorkspace<2>, PersistenceWorkspace<3>, PersistenceWorkspace<4> > spaces;
+	vector<double> values;		// for callers that convert an image before computing it
+	PersDiagramArrays pairs;	// for callers that copy the pairs out before releasing the workspace
+	vector<double> robustness;	// likewise for a robustness map
+
+	template<int dim>
+	PersistenceWorkspace<dim> &of()
+	{
+		return std::get<dim-1>(spaces);
+	}
+};
+
+class PersistenceWorkspacePool
+{
+public:
+	std::unique_ptr<PersistenceWorkspaces> acquire()
+	{
+		std::lock_guard<std::mutex> lock(m);
+		if (idle.empty())
+			return std::unique_ptr<PersistenceWorkspaces>(new PersistenceWorkspaces);
+		std::unique_ptr<PersistenceWorkspaces> ws(idle.back());
+		idle.pop_back();
+		return ws;
+	}
+
+	void release(std::unique_ptr<PersistenceWorkspaces> ws)
+	{
+		std::lock_guard<std::mutex> lock(m);
+		idle.push_back(ws.release());
+	}
+
+	// frees the workspaces not in use, returns how many
+	size_t clear()
+	{
+		std::lock_guard<std::mutex> lock(m);
+		size_t n = idle.size();
+		for (size_t i = 0; i < n; i++)
+			delete idle[i];
+		idle.clear();
+		return n;
+	}
+
+	~PersistenceWorkspacePool()
+	{
+		clear();
+	}
+
+	// the pool of the process; there are at most as many workspaces as computations ran at once
+	static PersistenceWorkspacePool &shared()
+	{
+		static PersistenceWorkspacePool pool;
+		return pool;
+	}
+
+private:
+	std::mutex m;
+	vector<PersistenceWorkspaces *> idle;
+};
+
+struct PooledWorkspace
+{
+	std::unique_ptr<PersistenceWorkspaces> ws;
+
+	explicit PooledWorkspace(PersistenceWorkspacePool &pool = PersistenceWorkspacePool::shared())
+		: ws(pool.acquire()), pool(pool)
+	{}
+
+	~PooledWorkspace()
+	{
+		pool.release(std::move(ws));
+	}
+
+	PersistenceWorkspaces *operator->()
+	{
+		return ws.get();
+	}
+
+	PersistenceWorkspaces &operator*()
+	{
+		return *ws;
+	}
+
+private:
+	PooledWorkspace(const PooledWorkspace &);
+	PooledWorkspace &operator=(const PooledWorkspace &);
+
+	PersistenceWorkspacePool &pool;
+};
+
+#endif
@@ -29,4 +29,117 @@ public:
 	//NOTE this is not sorted according to the robustness
 };
 
+// The pairs of one homology dimension as parallel arrays: no PersPair or TinyVector
+// is built per pair, and the arrays can be handed over to NumPy as they are.
+// Reading an element gives a PersPair by value.
+template<typename VertexT>
+class PersPairList{
+public:
+	enum { vertDim = VertexT::numElements };
+
+	vector<double> persistence;
+	vector<double> birth;
+	vector<double> death;
+	// vertDim coordinates per pair
+	vector<int> birth_coords;
+	vector<int> death_coords;
+
+	size_t size() const { return birth.size(); }
+	bool empty() const { return birth.empty(); }
+
+	void reserve(size_t n){
+		persistence.reserve(n);
+		birth.reserve(n);
+		death.reserve(n);
+		birth_coords.reserve(n * vertDim);
+		death_coords.reserve(n * vertDim);
+	}
+
+	void clear(){
+		PersPairList().swap(*this);
+	}
+
+	void swap(PersPairList &other){
+		persistence.swap(other.persistence);
+		birth.swap(other.birth);
+		death.swap(other.death);
+		birth_coords.swap(other.birth_coords);
+		death_coords.swap(other.death_coords);
+	}
+
+	void append(const VertexT &vBirth, const VertexT &vDeath, double pers, double b, double d){
+		MY_ASSERT(d>=b);
+		persistence.push_back(pers);
+		birth.push_back(b);
+		death.push_back(d);
+		for (int k = 0; k < vertDim; k++){
+			birth_coords.push_back(vBirth[k]);
+			death_coords.push_back(vDeath[k]);
+		}
+	}
+
+	void push_back(const PersPair<VertexT> &p){
+		append(p.birthV, p.deathV, p.persistence, p.birth, p.death);
+	}
+
+	VertexT birthV(size_t i) const { return vertexAt(birth_coords, i); }
+	VertexT deathV(size_t i) const { return vertexAt(death_coords, i); }
+
+	PersPair<VertexT> operator[](size_t i) const{
+		return PersPair<VertexT>(birthV(i), deathV(i), persistence[i], birth[i], death[i]);
+	}
+
+	// new function values for the same critical vertices
+	void setValues(size_t i, double b, double d){
+		birth[i] = b;
+		death[i] = d;
+		persistence[i] = d - b;
+	}
+
+	// read-only; 'it->birth' works as for a vector of PersPair
+	class const_iterator{
+	public:
+		struct arrow{
+			PersPair<VertexT> p;
+			const PersPair<VertexT> *operator->() const { return &p; }
+		};
+
+		const_iterator() : list(NULL), i(0) {}
+		const_iterator(const PersPairList *l, size_t i) : list(l), i(i) {}
+		PersPair<VertexT> operator*() const { return (*list)[i]; }
+		arrow operator->() const { arrow a = {(*list)[i]}; return a; }
+		const_iterator &operator++() { ++i; return *this; }
+		const_iterator operator++(int) { const_iterator old(*this); ++i; return old; }
+		bool operator==(const const_iterator &rhs) const { return i == rhs.i; }
+		bool operator!=(const const_iterator &rhs) const { return i != rhs.i; }
+	private:
+		const PersPairList *list;
+		size_t i;
+	};
+	typedef const_iterator iterator;
+
+	const_iterator begin() const { return const_iterator(this, 0); }
+	const_iterator end() const { return const_iterator(this, size()); }
+
+private:
+	static VertexT vertexAt(const vector<int> &coords, size_t i){
+		VertexT v;
+		for (int k = 0; k < vertDim; k++)
+			v[k] = coords[i * vertDim + k];
+		return v;
+	}
+};
+
+// The pairs of all homology dimensions of one image in one set of arrays, for Python.
+struct PersDiagramArrays{
+	int dim;
+	vector<int> hom_dim;
+	vector<double> birth;
+	vector<double> death;
+	vector<double> persistence;
+	// dim coordinates per pair
+	vector<int> birth_coords;
+	vector<int> death_coords;
+};
+
 #endif
@@ -1,47 +1,184 @@
 #ifndef INCLUDED_REDUCTION_H
 #define INCLUDED_REDUCTION_H
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
 #include "GeneralFiltration.h"
+#include "ColumnStore.h"
+
+// Reduced matrices carried from one computation to the next on a filtration that starts
+// with the same vertices. The cells whose maximal vertex lies in that common prefix keep
+// their numbers, so the corresponding leading columns reduce exactly as before.
+struct WarmReduction
+{
+	WarmReduction() : prefix_vertices(0), keep(false), numbered(false) {}
+
+	// leading vertices of vList in the same order as in the previous computation
+	int prefix_vertices;
+	// the reduced columns of each dimension, from the previous computation / for the next one
+	vector< vector< MatrixListType > > reduced;
+	// whether the reduced columns of this computation are kept in 'reduced'
+	bool keep;
+	// whether the workspace of the warm start holds the cell numbering of the last computation
+	bool numbered;
+	// the pairs of the last computation as (birth, death) ranks in vList, per homology
+	// dimension; a pair born and dying at the same vertex always has persistence 0 and is left out
+	vector< vector< pair<int, int> > > pivots;
+};
+
+// Notified between the columns of reduceND, e.g. to take checkpoints.
+struct ReductionObserver
+{
+	virtual ~ReductionObserver() {}
+
+	// all columns before 'next_column' are reduced
+	virtual void columnsReduced(size_t next_column) = 0;
+};
+
+// The pivots of a running reduction, for a thread that builds the next boundary matrix
+// meanwhile (see CubicalFiltration::buildBoundaries): a row is marked as soon as it becomes
+// a pivot, and the progress tells how far the columns are reduced. The marks only save
+// work; the builder's caller still drops the columns cleared once the reduction is done.
+class PivotFeed
+{
+public:
+	PivotFeed() : upperList(NULL), reduced(0), finished(false) {}
+
+	// for a reduction of the columns born at 'upperList' clearing 'rows' rows, from 'first_column' on
+	void reset(size_t rows, const vector<CellNrType> &upper, size_t first_column)
+	{
+		words.reset(new std::atomic<uint32_t>[rows / 32 + 1]);
+		for (size_t i = 0; i <= rows / 32; i++)
+			words[i].store(0, std::memory_order_relaxed);
+		upperList = &upper;
+		reduced.store(first_column);
+		finished = false;
+	}
+
+	void publish(int row)
+	{
+		words[row >> 5].fetch_or(1u << (row & 31), std::memory_order_relaxed);
+	}
+
+	bool cleared(int row) const
+	{
+		return (words[row >> 5].load(std::memory_order_relaxed) >> (row & 31)) & 1u;
+	}
+
+	// all columns before 'next_column' are reduced
+	void progress(size_t next_column)
+	{
+		reduced.store(next_column, std::memory_order_relaxed);
+		if ((next_column & 1023) == 0)
+			advanced.notify_all();
+	}
+
+	// releases the builder, also when the reduction failed
+	void finish()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m);
+			finished = true;
+		}
+		advanced.notify_all();
+	}
+
+	// until the columns born at vertex 'v' or before are reduced; a missed
+	// notification only delays the builder by the timeout
+	void waitForVertex(int v)
+	{
+		size_t needed = upper_bound(upperList->begin(), upperList->end(), v) - upperList->begin();
+		if (reduced.load(std::memory_order_relaxed) >= needed)
+			return;
+		std::unique_lock<std::mutex> lock(m);
+		while (!finished && reduced.load(std::memory_order_relaxed) < needed)
+			advanced.wait_for(lock, std::chrono::milliseconds(1));
+	}
+
+private:
+	std::unique_ptr< std::atomic<uint32_t>[] > words;
+	const vector<CellNrType> *upperList;
+	std::atomic<size_t> reduced;
+	bool finished;
+	std::mutex m;
+	std::condition_variable advanced;
+};
 
 // This function reduces a boundary matrix represented by its 'low_array'.
-void reduceND(vector<bool> &willBeCleared, vector<CellNrType> &upperList, vector<MatrixListType> &boundary_upper, vector<int> &low_array, vector< MatrixListType > & reduction_list) 
+// Column additions are accumulated in the per-thread MergeArena, so the matrix
+// itself is written only once per column.
+// If 'used_columns' is given, it records for each column the columns that were
+// added to it; reconstructReductionLists() turns this into reduction lists later,
+// only for the columns somebody asks for.
+// ColumnsT is a vector of columns, or a ColumnStore when memory is bounded.
+// A resumed reduction starts at 'first_column'; the columns before it must already be
+// reduced, with their pivots in 'low_array' and 'willBeCleared'.
+// If 'feed' is given, the pivots and the progress are published in it as they are found.
+template<typename ColumnsT>
+void reduceND(vector<bool> &willBeCleared, vector<CellNrType> &upperList, ColumnsT &boundary_upper, vector<int> &low_array, ColumnsT * used_columns,
+	size_t first_column = 0, ReductionObserver * observer = NULL, PivotFeed * feed = NULL) 
 {
 	OUTPUT_MSG("Reducing cells, total number = " << upperList.size());
-	for(size_t i=0, sz = upperList.size(); i < sz; i++){
-		reduction_list.push_back( MatrixListType() );
-		MY_ASSERT( reduction_list.size() == i + 1 );
-		
-		if (boundary_upper[i].empty())
+	MergeArena<MatrixListType> &arena = MergeArena<MatrixListType>::local();
+	MatrixListType &column = arena.work;
+	MatrixListType used;
+
+	if (used_columns && first_column == 0)
+		resetColumns(*used_columns, upperList.size());
+
+	for(size_t i=first_column, sz = upperList.size(); i < sz; i++){
+		if (observer && i > first_column && (i & 1023) == 0)
+			observer->columnsReduced(i);
+		if (feed)
+			feed->progress(i);
+
+		const MatrixListType &original = boundary_upper[i];
+		if (original.empty())
 			continue;
 
-		reduction_list[i].push_back( i );
-		// initialize the reduction list first
+		column.assign(original.begin(), original.end());
+		used.clear();
 		
-		int low = boundary_upper[i].back();
+		int low = column.back();
 		int column_used=0;
-		while (!boundary_upper[i].empty() && low_array[low]!=BIG_INT){
+		while (!column.empty() && low_array[low]!=BIG_INT){
 			assert(low_array[low] < i);
 			assert(low == boundary_upper[low_array[low]].back());
-			assert(!boundary_upper[i].empty());
 			assert(!boundary_upper[low_array[low]].empty());
 
-			boundary_upper[i]=list_sym_diff(boundary_upper[i], boundary_upper[low_array[low]]);
-			// update the reduction list as well
-			reduction_list[i]=list_sym_diff(reduction_list[i], reduction_list[low_array[low]]);
-			if(!boundary_upper[i].empty()){
+#ifdef REDUCTION_MERGE_TRACE
+			REDUCTION_MERGE_TRACE(column, boundary_upper[low_array[low]]);
+#endif
+			list_sym_diff_inplace(column, boundary_upper[low_array[low]], arena.scratch);
+			// remember the column, so that the reduction list can be rebuilt
+			if (used_columns)
+				used.push_back(low_array[low]);
+			if(!column.empty()){
 				int old_low=low;
-				low = boundary_upper[i].back();
+				low = column.back();
 				assert(low<old_low);
 			}
 
 			column_used++;		
 		}
-		if (!boundary_upper[i].empty()){
+		if (column_used > 0){
+			setColumn(boundary_upper, i, column);
+			if (used_columns)
+				setColumn(*used_columns, i, used);
+		}
+
+		if (!column.empty()){
 			assert(low>=0);
 			assert(low_array[low]==BIG_INT);
 			low_array[low]=i;								  
 
 			willBeCleared[low] = true;			
+			if (feed)
+				feed->publish(low);
 		}else{
 			// a column has to remain non-empty after reduction, 
 			// because this is a negative column
@@ -56,4 +193,40 @@ void reduceND(vector<bool> &willBeCleared, vector<CellNrType> &upperList, vector
 	//myclear(boundary_upper);
 }
 
+// The reduction list of column i is {i} xor the reduction lists of the columns
+// added to it. These columns are all smaller than i, so after collecting everything
+// reachable from the requested columns we can fill the lists in increasing order.
+// Only the requested columns and their dependencies are computed.
+template<typename ColumnsT>
+void reconstructReductionLists(ColumnsT &used_columns, const vector<int> &requested, vector< MatrixListType > & reduction_list)
+{
+	MergeArena<MatrixListType> &arena = MergeArena<MatrixListType>::local();
+
+	reduction_list.assign(used_columns.size(), MatrixListType());
+	vector<bool> needed(used_columns.size(), false);
+	vector<int> stack(requested.begin(), requested.end());
+	vector<int> order;
+	while (!stack.empty()){
+		int c = stack.back();
+		stack.pop_back();
+		if (needed[c])
+			continue;
+		needed[c] = true;
+		order.push_back(c);
+		const MatrixListType &used = used_columns[c];
+		stack.insert(stack.end(), used.begin(), used.end());
+	}
+	mysort(order);
+
+	for (size_t k = 0; k < order.size(); k++){
+		int c = order[k];
+		MatrixListType &red_column = arena.red_work;
+		red_column.assign(1, c);
+		const MatrixListType &used = used_columns[c];
+		for (MatrixListType::const_iterator it = used.begin(); it != used.end(); ++it)
+			list_sym_diff_inplace(red_column, reduction_list[*it], arena.scratch);
+		reduction_list[c].assign(red_column.begin(), red_column.end());
+	}
+}
+
 #endif
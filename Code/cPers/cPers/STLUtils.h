@@ -1,6 +1,8 @@
 #ifndef STLUTILS_INCLUDED
 #define STLUTILS_INCLUDED
 
+#include "MergeKernels.h"
+
 template<typename ListT>
 void mysort(ListT &l)
 {
@@ -25,66 +27,145 @@ void myclear(list<ElemT> &l)
 	l.clear();
 }
 
-template <class Container>
-struct Counter
- : public std::iterator <std::output_iterator_tag,
-                         void, void, void, void>
-{ 
-	size_t &cnt;
-
-    Counter(size_t &x) : cnt(x) {}	
- 
-	template<typename t>
-    Counter& operator=(t)
-	{        
-        return *this;
-    }
-    
-    Counter& operator* () 
-	{
-        return *this;
-    }
-    
-    Counter& operator++(int) 
-	{
-		++cnt;
-        return *this;
-    }    
-
-	Counter& operator++() 
-	{
-		++cnt;
-        return *this;
-    }    
-};
+// Single-pass merge kernels writing into a caller-owned buffer.
+// 'out' keeps its capacity between calls, so once it has grown to the size of
+// the longest column no further allocations happen.
+template<typename ListT>
+void list_sym_diff_into(const ListT &sa, const ListT &sb, ListT &out){
+	//assume inputs are both sorted increasingly
+	out.clear();
+	out.reserve(sa.size() + sb.size());
+	set_symmetric_difference(sa.begin(), sa.end(), sb.begin(), sb.end(), back_inserter(out));
+}
+template<typename ListT>
+void list_union_into(const ListT &sa, const ListT &sb, ListT &out){
+	//assume inputs are both sorted increasingly
+	out.clear();
+	out.reserve(sa.size() + sb.size());
+	set_union(sa.begin(), sa.end(), sb.begin(), sb.end(), back_inserter(out));
+}
 
+// Columns of cell numbers go through the vectorized kernels (see MergeKernels.h).
+// 'out' is only grown, never cleared, so that no memory is zeroed needlessly.
+inline void list_merge_into(MergeKernelFn kernel, const vector<int> &sa, const vector<int> &sb, vector<int> &out){
+	size_t need = sa.size() + sb.size() + kMergeSlack;
+	if (out.size() < need)
+		out.resize(need);
+	const int *a = sa.empty() ? NULL : &sa[0];
+	const int *b = sb.empty() ? NULL : &sb[0];
+	out.resize(kernel(a, sa.size(), b, sb.size(), &out[0]));
+}
+inline void list_sym_diff_into(const vector<int> &sa, const vector<int> &sb, vector<int> &out){
+	list_merge_into(MergeKernels::get().sym_diff, sa, sb, out);
+}
+inline void list_union_into(const vector<int> &sa, const vector<int> &sb, vector<int> &out){
+	list_merge_into(MergeKernels::get().union_, sa, sb, out);
+}
 
-// We avoid excessive allocations by calculating the size of the resulting list.
-// Then we resize the result and populate it with the actual values.
 template<typename ListT>
 ListT list_sym_diff(ListT &sa, ListT &sb){
-	//assume inputs are both sorted increasingly	
-	size_t count = 0;
-	Counter<ListT> counter(count);
-	set_symmetric_difference(sa.begin(), sa.end(), sb.begin(), sb.end(), counter);
 	ListT out;
-	
-	out.reserve(count);
-	set_symmetric_difference(sa.begin(), sa.end(), sb.begin(), sb.end(), back_inserter(out));	
-
+	list_sym_diff_into(sa, sb, out);
 	return out;
 }
 template<typename ListT>
 ListT list_union(ListT &sa, ListT &sb){
-	//assume inputs are both sorted increasingly	
-	size_t count = 0;
-	Counter<ListT> counter(count);
-	set_union(sa.begin(), sa.end(), sb.begin(), sb.end(), counter);
 	ListT out;
-	
-	out.reserve(count);
-	set_union(sa.begin(), sa.end(), sb.begin(), sb.end(), back_inserter(out));	
-
+	list_union_into(sa, sb, out);
 	return out;
 }
+
+// In-place versions: the result replaces 'sa', and its old storage becomes the new scratch.
+template<typename ListT>
+void list_sym_diff_inplace(ListT &sa, const ListT &sb, ListT &scratch){
+	list_sym_diff_into(sa, sb, scratch);
+	sa.swap(scratch);
+}
+template<typename ListT>
+void list_union_inplace(ListT &sa, const ListT &sb, ListT &scratch){
+	list_union_into(sa, sb, scratch);
+	sa.swap(scratch);
+}
+
+// Reusable buffers for the column arithmetic. The reduction accumulates a column
+// in 'work' (and its reduction list in 'red_work'), ping-ponging with 'scratch',
+// and copies the result back to the matrix only once the column is finished.
+// Each thread has its own arena, so the buffers are never shared.
+template<typename ListT>
+struct MergeArena
+{
+	ListT work;
+	ListT red_work;
+	ListT scratch;
+
+	static MergeArena &local()
+	{
+		static thread_local MergeArena arena;
+		return arena;
+	}
+};
+
+// Set of ids in [0, n) with O(1) reset: an id is in the set iff its stamp equals
+// the current epoch, so clearing the set is just bumping the epoch.
+// Used to assemble the union of many short sorted lists in linear time instead
+// of folding list_union over them, which re-merges the growing result each step.
+struct EpochSet
+{
+	vector<unsigned> stamp;
+	unsigned epoch;
+
+	EpochSet() : epoch(0) {}
+
+	void reset(size_t n)
+	{
+		if (stamp.size() < n)
+			stamp.resize(n, 0);
+		if (++epoch == 0){
+			fill(stamp.begin(), stamp.end(), 0);
+			epoch = 1;
+		}
+	}
+
+	// Returns true if the id was not in the set yet.
+	bool insert(int id)
+	{
+		if (stamp[id] == epoch)
+			return false;
+		stamp[id] = epoch;
+		return true;
+	}
+
+	static EpochSet &local()
+	{
+		static thread_local EpochSet set;
+		return set;
+	}
+};
+
+// out = sorted union of lists[k] for all k in 'indices'; all ids must be below 'n'.
+template<typename ListT>
+void list_union_gather(const ListT &indices, const vector<ListT> &lists, size_t n, ListT &out)
+{
+#ifdef LIST_UNION_TRACE
+	// the operands that folding list_union over the lists would see
+	ListT acc, next;
+	for (typename ListT::const_iterator k = indices.begin(); k != indices.end(); ++k){
+		ListT l = lists[*k];
+		mysort(l);
+		LIST_UNION_TRACE(acc, l);
+		list_union_into(acc, l, next);
+		acc.swap(next);
+	}
+#endif
+	EpochSet &visited = EpochSet::local();
+	visited.reset(n);
+	out.clear();
+	for (typename ListT::const_iterator k = indices.begin(); k != indices.end(); ++k){
+		const ListT &l = lists[*k];
+		for (typename ListT::const_iterator it = l.begin(); it != l.end(); ++it)
+			if (visited.insert(*it))
+				out.push_back(*it);
+	}
+	mysort(out);
+}
 #endif
@@ -0,0 +1,125 @@
+#ifndef INCLUDED_THREAD_POOL_H
+#define INCLUDED_THREAD_POOL_H
+
+// A fixed set of worker threads taking tasks from a queue, for computing many
+// images at once. The workers are quiet (see DebuggerClass::console), the log
+// file is shared and locked. A task that throws does not take its worker down:
+// the first exception is rethrown by wait().
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "Debugging.h"
+
+class ThreadPool
+{
+public:
+	// 0 threads: one per core
+	explicit ThreadPool(int threads = 0)
+		: active(0), stopping(false)
+	{
+		if (threads <= 0)
+			threads = defaultThreads();
+		for (int i = 0; i < threads; i++)
+			workers.push_back(std::thread(&ThreadPool::work, this));
+	}
+
+	// runs what is queued, then stops the workers
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m);
+			stopping = true;
+		}
+		task_ready.notify_all();
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+
+	void submit(const std::function<void()> &task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m);
+			tasks.push_back(task);
+		}
+		task_ready.notify_one();
+	}
+
+	// until every submitted task has finished; rethrows the first exception a task threw
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(m);
+		all_done.wait(lock, [this](){ return tasks.empty() && active == 0; });
+		if (error){
+			std::exception_ptr e = error;
+			error = std::exception_ptr();
+			std::rethrow_exception(e);
+		}
+	}
+
+	int size() const
+	{
+		return workers.size();
+	}
+
+	// the cores this process may run on (taskset, cpusets), not all cores of the machine
+	static int defaultThreads()
+	{
+#ifdef __linux__
+		cpu_set_t cpus;
+		if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0 && CPU_COUNT(&cpus) > 0)
+			return CPU_COUNT(&cpus);
+#endif
+		int n = std::thread::hardware_concurrency();
+		return n > 0 ? n : 1;
+	}
+
+private:
+	ThreadPool(const ThreadPool &);
+	ThreadPool &operator=(const ThreadPool &);
+
+	void work()
+	{
+		DebuggerClass::setThreadQuiet(true);
+		std::unique_lock<std::mutex> lock(m);
+		for (;;){
+			task_ready.wait(lock, [this](){ return stopping || !tasks.empty(); });
+			if (tasks.empty())
+				return;
+			std::function<void()> task = tasks.front();
+			tasks.pop_front();
+			active++;
+			lock.unlock();
+			std::exception_ptr e;
+			try {
+				task();
+			} catch (...) {
+				e = std::current_exception();
+			}
+			lock.lock();
+			if (e && !error)
+				error = e;
+			active--;
+			if (tasks.empty() && active == 0)
+				all_done.notify_all();
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::deque< std::function<void()> > tasks;
+	size_t active;
+	bool stopping;
+	std::exception_ptr error;
+	std::mutex m;
+	std::condition_variable task_ready, all_done;
+};
+
+#endif
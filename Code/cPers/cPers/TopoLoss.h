@@ -0,0 +1,482 @@
+#ifndef INCLUDED_TOPO_LOSS_H
+#define INCLUDED_TOPO_LOSS_H
+
+// The per-patch work of getTopoLoss (topoloss_pytorch.py) in one call:
+//  - the diagrams of likelihood and ground truth, as getCriticalPoints: the finite pairs of
+//    1 - patch, with their birth and death pixels (constant patches and patches where either
+//    diagram has no pairs are skipped);
+//  - the matching of compute_dgm_force: the gt_n_holes most persistent likelihood dots are
+//    kept, those among them below pers_thresh_perfect are pushed to (0, 1) ("fix"), the
+//    others above pers_thresh are pushed to the diagonal ("remove");
+//  - the critical point maps: the weight map is 1 at the birth and death pixels of every
+//    moved dot, the reference map holds the value they are pushed to.
+// getTopoLoss works on 2D patches and 0-dimensional pairs. Here patches may also be 3D
+// volumes, and each homology dimension of TopoLossDims is matched on its own with its own
+// thresholds; the forces of all of them go into the same maps.
+// The diagrams come from this module's cubical complex (pixels are vertices, 4-connected),
+// where gudhi's puts pixels in top cells (8-connected): critical points may differ where
+// structures touch only diagonally.
+
+#include <algorithm>
+#include <cmath>
+
+#include "InputRunner.h"
+#include "ThreadPool.h"
+
+// homology dimensions of 3D volumes
+const int kMaxTopoLossHomDims = 3;
+
+struct TopoLossParams
+{
+	double pers_thresh;
+	double pers_thresh_perfect;
+
+	TopoLossParams(double pers_thresh = 0.03, double pers_thresh_perfect = 0.99)
+		: pers_thresh(pers_thresh), pers_thresh_perfect(pers_thresh_perfect)
+	{}
+};
+
+// The homology dimensions the loss acts on (bit k of 'mask' for dimension k), each with
+// its thresholds.
+struct TopoLossDims
+{
+	unsigned mask;
+	TopoLossParams params[kMaxTopoLossHomDims];
+
+	// dimension 0 only, as getTopoLoss
+	explicit TopoLossDims(const TopoLossParams &p = TopoLossParams()) : mask(1u)
+	{
+		std::fill(params, params + kMaxTopoLossHomDims, p);
+	}
+
+	bool has(int k) const
+	{
+		return (mask >> k) & 1u;
+	}
+};
+
+struct TopoLossPatchResult
+{
+	bool skipped;		// constant patch or no dimension with pairs in both diagrams, the maps are untouched
+	int fixed, removed;
+	double loss;		// sum of the squared forces on the diagram, as compute_topological_loss
+	double dim_loss[kMaxTopoLossHomDims];	// the part of 'loss' of each homology dimension
+
+	TopoLossPatchResult() : skipped(true), fixed(0), removed(0), loss(0)
+	{
+		std::fill(dim_loss, dim_loss + kMaxTopoLossHomDims, 0.0);
+	}
+};
+
+// A box of an image: 'shape' values along each axis, 'strides' values apart.
+template<int dim>
+struct TopoLossBox
+{
+	int shape[dim];
+	size_t strides[dim];
+
+	size_t size() const
+	{
+		size_t n = 1;
+		for (int k = 0; k < dim; k++)
+			n *= shape[k];
+		return n;
+	}
+
+	// the offset of the i-th value of the box, in C order
+	size_t offset(size_t i) const
+	{
+		size_t o = 0;
+		for (int k = dim - 1; k >= 0; k--){
+			o += (i % shape[k]) * strides[k];
+			i /= shape[k];
+		}
+		return o;
+	}
+
+	size_t offset(const int *coords) const
+	{
+		size_t o = 0;
+		for (int k = 0; k < dim; k++)
+			o += coords[k] * strides[k];
+		return o;
+	}
+
+	// a box of 'shape' in a C-ordered array of 'extents'
+	static TopoLossBox inArray(const int *shape, const int *extents)
+	{
+		TopoLossBox b;
+		size_t s = 1;
+		for (int k = dim - 1; k >= 0; k--){
+			b.shape[k] = shape[k];
+			b.strides[k] = s;
+			s *= extents[k];
+		}
+		return b;
+	}
+};
+
+// The pairs of the homology dimensions in 'hom_dim_mask' of 1 - patch.
+// 'count_only' lets a mask take the faster way of MaskPersistence.h, for a diagram whose
+// pairs are only counted: its birth and death pixels may differ from the reduction's.
+template<int dim, typename ValueT>
+void criticalPairs(const ValueT *patch, const TopoLossBox<dim> &box, unsigned hom_dim_mask, PersDiagramArrays &out,
+	bool count_only = false)
+{
+	PooledWorkspace ws;
+	vector<double> &f = ws->values;
+	f.resize(box.size());
+	const int w = box.shape[dim-1];
+	for (size_t r = 0, rows = f.size() / w; r < rows; r++){
+		const ValueT *row = patch + box.offset(r * w);
+		for (int c = 0; c < w; c++)
+			f[r * w + c] = 1.0 - row[c * box.strides[dim-1]];
+	}
+
+	vector<int> dims(box.shape, box.shape + dim);
+	InputFileInfo info(dim);
+	info.hom_dim_mask = hom_dim_mask;
+	info.allow_pipeline = false;
+	info.allow_mask_path = count_only;
+	InputRunner<dim>::run_arrays(info, dims, &f[0], 0.0, out, &ws->of<dim>());
+}
+
+// The min/max loop has no data-dependent branch inside a row, so it vectorizes; a patch
+// stops being a candidate as soon as a row has shown values above 0 and below 1.
+template<int dim, typename ValueT>
+bool constantPatch(const ValueT *patch, const TopoLossBox<dim> &box)
+{
+	const int w = box.shape[dim-1];
+	const size_t step = box.strides[dim-1];
+	ValueT lo = patch[0], hi = patch[0];
+	for (size_t r = 0, rows = box.size() / w; r < rows; r++){
+		const ValueT *row = patch + box.offset(r * w);
+		for (int c = 0; c < w; c++){
+			lo = row[c * step] < lo ? row[c * step] : lo;
+			hi = row[c * step] > hi ? row[c * step] : hi;
+		}
+		if (lo < 1 && hi > 0)
+			return false;
+	}
+	return lo == 1 || hi == 0;
+}
+
+// The dots of 'lh' among 'dots' to fix and to remove, by decreasing persistence.
+inline void matchDiagrams(const PersDiagramArrays &lh, const vector<int> &dots, size_t gt_n_holes, const TopoLossParams &params,
+	vector<int> &fix, vector<int> &remove)
+{
+	size_t n = dots.size();
+	vector<int> order(dots);
+	std::stable_sort(order.begin(), order.end(), [&lh](int a, int b){
+		return std::fabs(lh.death[a] - lh.birth[a]) > std::fabs(lh.death[b] - lh.birth[b]);
+	});
+
+	size_t keep = std::min(gt_n_holes, n);
+	size_t perfect = 0;
+	if (keep > 0)
+		for (size_t i = 0; i < n; i++)
+			perfect += std::fabs(lh.death[dots[i]] - lh.birth[dots[i]]) > params.pers_thresh_perfect;
+
+	fix.clear();
+	remove.clear();
+	for (size_t i = perfect; i < keep; i++)
+		fix.push_back(order[i]);
+	for (size_t i = keep; i < n; i++)
+		if (std::fabs(lh.death[order[i]] - lh.birth[order[i]]) > params.pers_thresh)
+			remove.push_back(order[i]);
+}
+
+// A pixel of a patch and the value its reference map entry gets; its weight becomes 1.
+template<int dim>
+struct TopoLossPoint
+{
+	int pos[dim];
+	double ref;
+
+	TopoLossPoint(const int *coords, double ref) : ref(ref)
+	{
+		std::copy(coords, coords + dim, pos);
+	}
+};
+
+// Matches the pairs 'pairs' of 'lh_dgm', the diagram of the patch 'lh' of the shape of 'box',
+// to a ground truth with gt_n_holes[k] pairs of dimension k. The critical points are
+// appended to 'points' in the order getTopoLoss writes them (later ones win), one homology
+// dimension after the other.
+template<int dim, typename ValueT>
+TopoLossPatchResult topoLossMatch(const ValueT *lh, const TopoLossBox<dim> &box, const PersDiagramArrays &lh_dgm,
+	const vector<int> &pairs, const size_t *gt_n_holes, const TopoLossDims &dims, vector< TopoLossPoint<dim> > &points)
+{
+	TopoLossPatchResult res;
+	const vector<int> &bc = lh_dgm.birth_coords, &dc = lh_dgm.death_coords;
+	vector<int> dots, fix, remove;
+	for (int k = 0; k < dim && k < kMaxTopoLossHomDims; k++){
+		if (!dims.has(k))
+			continue;
+		dots.clear();
+		for (size_t j = 0; j < pairs.size(); j++)
+			if (lh_dgm.hom_dim[pairs[j]] == k)
+				dots.push_back(pairs[j]);
+		// as getTopoLoss, a dimension without pairs in either diagram is left alone
+		if (dots.empty() || gt_n_holes[k] == 0)
+			continue;
+
+		matchDiagrams(lh_dgm, dots, gt_n_holes[k], dims.params[k], fix, remove);
+		res.skipped = false;
+		res.fixed += fix.size();
+		res.removed += remove.size();
+		double &loss = res.dim_loss[k];
+		for (size_t j = 0; j < fix.size(); j++){
+			int i = fix[j];
+			loss += lh_dgm.birth[i] * lh_dgm.birth[i] + (1 - lh_dgm.death[i]) * (1 - lh_dgm.death[i]);
+			// as getTopoLoss: the birth pixel to 0, the death pixel to 1
+			points.push_back(TopoLossPoint<dim>(&bc[dim*i], 0));
+			points.push_back(TopoLossPoint<dim>(&dc[dim*i], 1));
+		}
+		for (size_t j = 0; j < remove.size(); j++){
+			int i = remove[j];
+			double pers = lh_dgm.death[i] - lh_dgm.birth[i];
+			loss += pers * pers;
+			// birth and death to the diagonal: each pixel to the likelihood of the other
+			points.push_back(TopoLossPoint<dim>(&bc[dim*i], lh[box.offset(&dc[dim*i])]));
+			points.push_back(TopoLossPoint<dim>(&dc[dim*i], lh[box.offset(&bc[dim*i])]));
+		}
+		res.loss += loss;
+	}
+	return res;
+}
+
+// 'lh' and 'gt' are patches of the shape of 'box', matched as topoLossMatch.
+template<int dim, typename ValueT>
+TopoLossPatchResult topoLossPoints(const ValueT *lh, const ValueT *gt, const TopoLossBox<dim> &box,
+	const TopoLossDims &dims, vector< TopoLossPoint<dim> > &points)
+{
+	if (constantPatch(lh, box) || constantPatch(gt, box))
+		return TopoLossPatchResult();
+
+	PersDiagramArrays lh_dgm, gt_dgm;
+	criticalPairs(lh, box, dims.mask, lh_dgm);
+	if (lh_dgm.hom_dim.empty())
+		return TopoLossPatchResult();
+	criticalPairs(gt, box, dims.mask, gt_dgm, true);
+
+	vector<int> pairs(lh_dgm.hom_dim.size());
+	for (size_t i = 0; i < pairs.size(); i++)
+		pairs[i] = i;
+	size_t gt_n_holes[kMaxTopoLossHomDims];
+	for (int k = 0; k < kMaxTopoLossHomDims; k++)
+		gt_n_holes[k] = std::count(gt_dgm.hom_dim.begin(), gt_dgm.hom_dim.end(), k);
+	return topoLossMatch(lh, box, lh_dgm, pairs, gt_n_holes, dims, points);
+}
+
+// The maps point at the pixel of the patch's first value, 'map_strides' values apart.
+template<int dim, typename MapT>
+void writeTopoLossPoints(const vector< TopoLossPoint<dim> > &points, MapT *weight, MapT *ref, const size_t *map_strides)
+{
+	for (size_t j = 0; j < points.size(); j++){
+		size_t p = 0;
+		for (int k = 0; k < dim; k++)
+			p += points[j].pos[k] * map_strides[k];
+		weight[p] = 1;
+		ref[p] = points[j].ref;
+	}
+}
+
+// The patch of getTopoLoss: 'lh' and 'gt' are h x w patches with 'row_stride' values between
+// rows, the maps have 'map_stride' values between rows; 0-dimensional pairs only.
+template<typename ValueT, typename MapT>
+TopoLossPatchResult topoLossPatch(const ValueT *lh, const ValueT *gt, size_t row_stride, int h, int w,
+	MapT *weight, MapT *ref, size_t map_stride, const TopoLossParams &params)
+{
+	TopoLossBox<2> box;
+	box.shape[0] = h;
+	box.shape[1] = w;
+	box.strides[0] = row_stride;
+	box.strides[1] = 1;
+	size_t map_strides[2] = {map_stride, 1};
+	vector< TopoLossPoint<2> > points;
+	TopoLossPatchResult res = topoLossPoints(lh, gt, box, TopoLossDims(params), points);
+	writeTopoLossPoints(points, weight, ref, map_strides);
+	return res;
+}
+
+// Totals over the tiles of one image.
+struct TopoLossImageResult
+{
+	int tiles, skipped, fixed, removed;
+	double loss;
+	double dim_loss[kMaxTopoLossHomDims];
+
+	TopoLossImageResult() : tiles(0), skipped(0), fixed(0), removed(0), loss(0)
+	{
+		std::fill(dim_loss, dim_loss + kMaxTopoLossHomDims, 0.0);
+	}
+};
+
+// getTopoLoss over 'n' images of 'shape', one after another in 'lh' and 'gt': tiles of 'tile'
+// values along each axis starting every 'stride' values (the last ones cut at the border),
+// and the maps of the whole images, zeroed first. The tiles are computed in parallel on
+// 'pool' and written in getTopoLoss's order, so that where tiles overlap the last one wins.
+// With 'global_pairs', the diagrams are those of the whole images, computed once each: a
+// pair goes to every tile holding its birth and death pixels or, if none does, to every tile
+// holding its birth pixel, and each tile matches the pairs it got. Overlapping tiles share
+// the work, and a structure crossing tiles keeps its pair instead of getting one per tile;
+// the one pair of the image that never dies goes to no tile. With a stride larger than the
+// tile, a pair born in a gap between tiles goes to no tile either, as a gap is not penalized
+// without 'global_pairs'.
+template<int dim, typename ValueT, typename MapT>
+void topoLossTiles(const ValueT *lh, const ValueT *gt, int n, const int *shape, int tile, int stride,
+	MapT *weight, MapT *ref, const TopoLossDims &dims, bool global_pairs, ThreadPool &pool, vector<TopoLossImageResult> &out)
+{
+	struct Tile
+	{
+		int image;
+		size_t first;		// offset of the tile's first value in its image
+		TopoLossBox<dim> box;
+		TopoLossPatchResult res;
+		vector< TopoLossPoint<dim> > points;	// in the tile, in the image with 'global_pairs'
+		string error;
+		// with 'global_pairs': the pairs of the image's likelihood diagram it got, and the
+		// number of pairs of each dimension of the ground truth's
+		vector<int> pairs;
+		size_t gt_n_holes[kMaxTopoLossHomDims];
+	};
+
+	const TopoLossBox<dim> image = TopoLossBox<dim>::inArray(shape, shape);
+	const size_t image_size = image.size();
+	int counts[dim];
+	size_t per_image = 1;
+	for (int k = 0; k < dim; k++){
+		counts[k] = (shape[k] + stride - 1) / stride;
+		per_image *= counts[k];
+	}
+	vector<Tile> tiles(n * per_image);
+	for (size_t t = 0; t < tiles.size(); t++){
+		Tile &tl = tiles[t];
+		tl.image = t / per_image;
+		tl.first = 0;
+		std::fill(tl.gt_n_holes, tl.gt_n_holes + kMaxTopoLossHomDims, 0);
+		int tile_shape[dim];
+		size_t r = t % per_image;
+		for (int k = dim - 1; k >= 0; k--){
+			int start = (r % counts[k]) * stride;
+			r /= counts[k];
+			tile_shape[k] = std::min(tile, shape[k] - start);
+			tl.first += start * image.strides[k];
+		}
+		tl.box = TopoLossBox<dim>::inArray(tile_shape, shape);
+	}
+
+	if (global_pairs){
+		// the likelihood diagram of image i at 2i, the ground truth's at 2i+1
+		vector<PersDiagramArrays> dgms(2 * n);
+		vector<string> errors(2 * n);
+		for (int d = 0; d < 2 * n; d++)
+			pool.submit([&, d](){
+				try {
+					criticalPairs((d % 2 ? gt : lh) + (d / 2) * image_size, image, dims.mask, dgms[d]);
+				} catch (const std::exception &e) {
+					errors[d] = e.what();
+				}
+			});
+		pool.wait();
+		for (int d = 0; d < 2 * n; d++)
+			if (!errors[d].empty())
+				throw std::runtime_error(errors[d]);
+
+		// the tiles along axis k holding coordinate x: [lo[k], hi[k]]; false if there are
+		// none along some axis (x in a gap between tiles)
+		auto holding = [&](const int *x, int *lo, int *hi){
+			bool some = true;
+			for (int k = 0; k < dim; k++){
+				lo[k] = x[k] < tile ? 0 : (x[k] - tile) / stride + 1;
+				hi[k] = std::min(x[k] / stride, counts[k] - 1);
+				some = some && lo[k] <= hi[k];
+			}
+			return some;
+		};
+		int blo[dim], bhi[dim], dlo[dim], dhi[dim], lo[dim], hi[dim], c[dim];
+		for (int d = 0; d < 2 * n; d++){
+			const PersDiagramArrays &dgm = dgms[d];
+			Tile *first_tile = &tiles[(d / 2) * per_image];
+			for (size_t i = 0; i < dgm.hom_dim.size(); i++){
+				if (!holding(&dgm.birth_coords[dim*i], blo, bhi))
+					continue;
+				holding(&dgm.death_coords[dim*i], dlo, dhi);
+				bool both = true;
+				for (int k = 0; k < dim; k++){
+					lo[k] = std::max(blo[k], dlo[k]);
+					hi[k] = std::min(bhi[k], dhi[k]);
+					both = both && lo[k] <= hi[k];
+				}
+				if (!both){
+					std::copy(blo, blo + dim, lo);
+					std::copy(bhi, bhi + dim, hi);
+				}
+				// every tile of the box [lo, hi], in C order
+				std::copy(lo, lo + dim, c);
+				for (;;){
+					size_t t = 0;
+					for (int k = 0; k < dim; k++)
+						t = t * counts[k] + c[k];
+					if (d % 2)
+						first_tile[t].gt_n_holes[dgm.hom_dim[i]]++;
+					else
+						first_tile[t].pairs.push_back(i);
+					int k = dim - 1;
+					for (; k >= 0 && ++c[k] > hi[k]; k--)
+						c[k] = lo[k];
+					if (k < 0)
+						break;
+				}
+			}
+		}
+
+		for (size_t t = 0; t < tiles.size(); t++)
+			if (!tiles[t].pairs.empty())
+				pool.submit([&, t](){
+					Tile &tl = tiles[t];
+					try {
+						tl.res = topoLossMatch(lh + tl.image * image_size, image, dgms[2 * tl.image], tl.pairs,
+							tl.gt_n_holes, dims, tl.points);
+					} catch (const std::exception &e) {
+						tl.error = e.what();
+					}
+				});
+		pool.wait();
+	}
+	else {
+		for (size_t t = 0; t < tiles.size(); t++)
+			pool.submit([&, t](){
+				Tile &tl = tiles[t];
+				size_t first = tl.image * image_size + tl.first;
+				try {
+					tl.res = topoLossPoints(lh + first, gt + first, tl.box, dims, tl.points);
+				} catch (const std::exception &e) {
+					tl.error = e.what();
+				}
+			});
+		pool.wait();
+	}
+
+	std::fill(weight, weight + n * image_size, MapT(0));
+	std::fill(ref, ref + n * image_size, MapT(0));
+	out.assign(n, TopoLossImageResult());
+	for (size_t t = 0; t < tiles.size(); t++){
+		const Tile &tl = tiles[t];
+		if (!tl.error.empty())
+			throw std::runtime_error(tl.error);
+		size_t first = tl.image * image_size + (global_pairs ? 0 : tl.first);
+		writeTopoLossPoints(tl.points, weight + first, ref + first, image.strides);
+		TopoLossImageResult &r = out[tl.image];
+		r.tiles++;
+		r.skipped += tl.res.skipped;
+		r.fixed += tl.res.fixed;
+		r.removed += tl.res.removed;
+		r.loss += tl.res.loss;
+		for (int k = 0; k < kMaxTopoLossHomDims; k++)
+			r.dim_loss[k] += tl.res.dim_loss[k];
+	}
+}
+
+#endif
@@ -0,0 +1,630 @@
+#ifndef INCLUDED_VINEYARD_H
+#define INCLUDED_VINEYARD_H
+
+// Vineyard updates (Cohen-Steiner, Edelsbrunner, Morozov: "Vines and vineyards by updating
+// persistence in linear time") for the cubical lower-star filtration.
+//
+// For every dimension k we keep R_k = D_k V_k, with D_k the boundary matrix of the k-cells,
+// R_k reduced and V_k upper triangular. The initial decomposition comes from reduceND;
+// a cleared (positive) column j gets V_k[j] = R_{k+1}[c] for the column c killing j.
+// Cells keep the number they had in the initial filtration as their identity, so the
+// columns are sorted lists of ids and only 'pos' knows the current order.
+//
+// A new value array is reached by swapping adjacent vertices in the order in which they
+// cross on the straight line between the old and the new values. Each vertex swap reorders
+// the cells whose maximal vertex is one of the two, and each adjacent swap of two k-cells
+// is a transposition: the column swap is handled in R_k/V_k and the row swap in R_{k+1}/V_{k+1}
+// with the case analysis of the paper.
+// Every pair carries a vine id. When a transposition exchanges the partners of two pairs, the
+// id stays with the partner that was not transposed, so an id follows one point of the
+// persistence diagram while it moves.
+// When the orders differ by more vertex swaps than allowed, the decomposition is recomputed
+// and the ids are kept for the pairs of the same two cells. Following the vines is faster up
+// to about half as many vertex swaps as vertices, which is the default limit.
+
+#include <queue>
+#include <map>
+#include <stdexcept>
+
+#include "Reduction.h"
+#include "DataReaders.h"
+
+// One pair of the current diagram.
+template<int dim>
+struct VinePair
+{
+	typedef blitz::TinyVector<int, dim> Vertex;
+
+	int hom_dim;
+	int vine;
+	Vertex birthV, deathV;
+	double birth, death;
+};
+
+// What the Python wrapper sees of a Vineyard of any dimension.
+struct VineyardBase
+{
+	virtual ~VineyardBase() {}
+
+	virtual void update(const std::vector<double> &f, long long max_swaps) = 0;
+	// cubePers rows followed by the vine id
+	virtual std::vector<std::vector< double > > rows(double pers_thd) const = 0;
+
+	virtual long long lastSwaps() const = 0;
+	virtual long long lastTranspositions() const = 0;
+	virtual long long lastSwitches() const = 0;
+	virtual bool lastRecomputed() const = 0;
+};
+
+template<int dim>
+class Vineyard : public VineyardBase
+{
+public:
+	typedef blitz::TinyVector<int, dim> Index;
+	typedef blitz::TinyVector<int, dim> Vertex;
+
+	explicit Vineyard(const blitz::Array<double, dim> &phi)
+		: next_vine(0), last_swaps(0), last_transpositions(0), last_switches(0), last_recomputed(false)
+	{
+		neighbours = delta_generator<dim>::generate(dim);
+		int n3 = 1;
+		for (int i = 0; i < dim; i++)
+			n3 *= 3;
+		delta_order.assign(n3, -1);
+		for (size_t i = 0; i < neighbours.size(); i++)
+			delta_order[deltaCode(neighbours[i])] = i;
+
+		build(phi);
+	}
+
+	// Moves to the new values. More vertex swaps than max_swaps trigger a recomputation;
+	// a negative max_swaps stands for half the number of vertices.
+	void update(const blitz::Array<double, dim> &phi, long long max_swaps = -1)
+	{
+		MY_ASSERT(all(phi.extent() == f.extent()));
+		last_swaps = last_transpositions = last_switches = 0;
+		last_recomputed = false;
+
+		if (max_swaps < 0)
+			max_swaps = vList.size() / 2;
+		if (countInversions(phi) > max_swaps){
+			recompute(phi);
+			return;
+		}
+
+		// kinetic sort of the vertices along f_t = (1-t) f + t phi
+		typedef pair<double, int> Event;	// crossing time, rank of the first vertex
+		priority_queue<Event, vector<Event>, greater<Event> > events;
+		for (int r = 0; r + 1 < (int)vList.size(); r++)
+			pushCrossing(events, phi, r);
+
+		while (!events.empty()){
+			Event e = events.top();
+			events.pop();
+			int r = e.second;
+			if (crossing(phi, r) != e.first)
+				continue;	// another pair of vertices is at r by now
+			swapVertices(r);
+			if (r > 0)
+				pushCrossing(events, phi, r - 1);
+			if (r + 2 < (int)vList.size())
+				pushCrossing(events, phi, r + 1);
+		}
+
+		f = phi;
+	}
+
+	void pairs(vector< VinePair<dim> > &out, double pers_thd) const
+	{
+		out.clear();
+		for (int k = 1; k <= dim; k++){
+			// in the order of the birth cells, as calcPersistence reports them
+			for (size_t p = 0; p < cell_at[k-1].size(); p++){
+				int r = cell_at[k-1][p];
+				int c = pivot[k][r];
+				if (c < 0)
+					continue;
+				VinePair<dim> vp;
+				vp.hom_dim = k - 1;
+				vp.vine = vine[k][c];
+				vp.birthV = maxVertex(cell_coord[k-1][r]);
+				vp.deathV = maxVertex(cell_coord[k][c]);
+				vp.birth = f(vp.birthV);
+				vp.death = f(vp.deathV);
+				if (vp.death - vp.birth > pers_thd)
+					out.push_back(vp);
+			}
+		}
+	}
+
+	void update(const std::vector<double> &values, long long max_swaps)
+	{
+		if (values.size() != (size_t)f.size())
+			throw std::runtime_error("Vineyard: " + std::to_string(values.size()) + " values for an image of "
+				+ std::to_string(f.size()));
+		blitz::Array<double, dim> phi;
+		std::vector<int> dims(dim);
+		for (int i = 0; i < dim; i++)
+			dims[i] = f.extent(i);
+		PythonDataReader<dim, double> reader;
+		reader.read(string(), phi, dims, values);
+		update(phi, max_swaps);
+	}
+
+	std::vector<std::vector< double > > rows(double pers_thd) const
+	{
+		vector< VinePair<dim> > vp;
+		pairs(vp, pers_thd);
+		std::vector<std::vector< double > > ret(vp.size(), std::vector<double>(2*dim + 5));
+		for (size_t i = 0; i < vp.size(); i++){
+			ret[i][0] = vp[i].hom_dim;
+			ret[i][1] = vp[i].birth;
+			ret[i][2] = vp[i].death;
+			ret[i][3] = vp[i].death - vp[i].birth;
+			for (int k = 0; k < dim; k++){
+				ret[i][4+k] = vp[i].birthV(k);
+				ret[i][4+dim+k] = vp[i].deathV(k);
+			}
+			ret[i][4+2*dim] = vp[i].vine;
+		}
+		return ret;
+	}
+
+	long long lastSwaps() const { return last_swaps; }
+	long long lastTranspositions() const { return last_transpositions; }
+	long long lastSwitches() const { return last_switches; }
+	bool lastRecomputed() const { return last_recomputed; }
+
+private:
+	// --- the decomposition ---
+
+	void build(const blitz::Array<double, dim> &phi)
+	{
+		f.resize(phi.extent());
+		f = phi;
+
+		vList.clear();
+		CubicalFiltration<dim> filtration(&f);
+		filtration.init(&vList);
+
+		rank.resize(f.extent());
+		for (size_t i = 0; i < vList.size(); i++)
+			rank(vList[i]) = i;
+
+		const blitz::Array<int, dim> &order = filtration.getFiltrationOrder();
+		cell_id.resize(order.extent());
+		cell_id = order;
+		int sizes[dim+1];
+		for (int k = 0; k <= dim; k++){
+			sizes[k] = filtration.getSizeInDim(k);
+			cell_coord[k].resize(sizes[k]);
+			pos[k].resize(sizes[k]);
+			cell_at[k].resize(sizes[k]);
+			for (int i = 0; i < sizes[k]; i++)
+				pos[k][i] = cell_at[k][i] = i;
+		}
+		for (typename blitz::Array<int, dim>::const_iterator it = order.begin(), end = order.end(); it != end; ++it)
+			cell_coord[cellDim(it.position())][*it] = it.position();
+
+		// reduce from the top dimension down, with clearing, recording the column additions
+		vector<bool> cleared(sizes[dim], false);
+		for (int k = dim; k >= 1; k--){
+			vector<MatrixListType> used;
+			vector<int> low_array(sizes[k-1], BIG_INT);
+			vector<int> upper(sizes[k]);
+			R[k].clear();
+			filtration.calculateBoundaries(&vList, &R[k], k, cleared);
+			cleared.assign(sizes[k-1], false);
+			reduceND(cleared, upper, R[k], low_array, &used);
+
+			vector<int> negative;
+			for (int c = 0; c < sizes[k]; c++)
+				if (!R[k][c].empty())
+					negative.push_back(c);
+			reconstructReductionLists(used, negative, V[k]);
+		}
+
+		// lows, pivots, and the cycles of the cleared columns
+		for (int k = 1; k <= dim; k++){
+			low[k].assign(sizes[k], -1);
+			pivot[k].assign(sizes[k-1], -1);
+			vine[k].assign(sizes[k], -1);
+			for (int c = 0; c < sizes[k]; c++){
+				if (R[k][c].empty())
+					continue;
+				low[k][c] = R[k][c].back();
+				pivot[k][low[k][c]] = c;
+				vine[k][c] = next_vine++;
+			}
+		}
+		for (int k = 1; k < dim; k++)
+			for (int j = 0; j < sizes[k]; j++)
+				if (R[k][j].empty()){
+					MY_ASSERT(pivot[k+1][j] >= 0);
+					if (pivot[k+1][j] >= 0)
+						V[k][j] = R[k+1][pivot[k+1][j]];
+				}
+	}
+
+	// Computes everything again; a pair of the same two cells keeps its vine id.
+	void recompute(const blitz::Array<double, dim> &phi)
+	{
+		std::map<pair<int, int>, int> ids;	// (birth cell, death cell) on the doubled grid -> vine
+		for (int k = 1; k <= dim; k++)
+			for (size_t c = 0; c < low[k].size(); c++)
+				if (low[k][c] >= 0)
+					ids[make_pair(linear(cell_coord[k-1][low[k][c]]), linear(cell_coord[k][c]))] = vine[k][c];
+
+		int old_next = next_vine;
+		next_vine = 0;
+		build(phi);
+		next_vine = old_next;
+		for (int k = 1; k <= dim; k++)
+			for (size_t c = 0; c < low[k].size(); c++){
+				if (low[k][c] < 0)
+					continue;
+				std::map<pair<int, int>, int>::iterator it = ids.find(make_pair(linear(cell_coord[k-1][low[k][c]]), linear(cell_coord[k][c])));
+				vine[k][c] = (it != ids.end()) ? it->second : next_vine++;
+			}
+		last_recomputed = true;
+	}
+
+	// --- vertex swaps ---
+
+	// when the vertices of rank r and r+1 cross, -1 if they do not
+	double crossing(const blitz::Array<double, dim> &phi, int r) const
+	{
+		const Vertex &x = vList[r], &y = vList[r+1];
+		double h1 = phi(y) - phi(x);
+		if (!(h1 < 0))
+			return -1;
+		double h0 = f(y) - f(x);
+		return h0 <= 0 ? 0 : h0 / (h0 - h1);
+	}
+
+	void pushCrossing(priority_queue<pair<double, int>, vector< pair<double, int> >, greater< pair<double, int> > > &events,
+		const blitz::Array<double, dim> &phi, int r)
+	{
+		double t = crossing(phi, r);
+		if (t >= 0)
+			events.push(make_pair(t, r));
+	}
+
+	// number of pairs of vertices whose order differs between f and phi (stable on ties)
+	long long countInversions(const blitz::Array<double, dim> &phi) const
+	{
+		vector<double> a(vList.size());
+		for (size_t i = 0; i < vList.size(); i++)
+			a[i] = phi(vList[i]);
+		vector<double> tmp(a.size());
+		return mergeCount(a, tmp, 0, a.size());
+	}
+
+	static long long mergeCount(vector<double> &a, vector<double> &tmp, size_t lo, size_t hi)
+	{
+		if (hi - lo < 2)
+			return 0;
+		size_t mid = (lo + hi) / 2;
+		long long inv = mergeCount(a, tmp, lo, mid) + mergeCount(a, tmp, mid, hi);
+		size_t i = lo, j = mid, o = lo;
+		while (i < mid && j < hi){
+			if (a[j] < a[i]){
+				inv += mid - i;
+				tmp[o++] = a[j++];
+			}else{
+				tmp[o++] = a[i++];
+			}
+		}
+		while (i < mid)
+			tmp[o++] = a[i++];
+		while (j < hi)
+			tmp[o++] = a[j++];
+		copy(tmp.begin() + lo, tmp.begin() + hi, a.begin() + lo);
+		return inv;
+	}
+
+	// Swaps the vertices of rank r and r+1 and brings the cells of their lower stars into
+	// the order the filtration would give them.
+	void swapVertices(int r)
+	{
+		Vertex u = vList[r], v = vList[r+1];
+		vList[r] = v;
+		vList[r+1] = u;
+		rank(u) = r + 1;
+		rank(v) = r;
+		last_swaps++;
+
+		vector<int> block[dim+1];
+		const Index big_extent = 2 * f.extent() - 1;
+		for (int w = 0; w < 2; w++){
+			Index center = 2 * (w == 0 ? u : v);
+			for (size_t i = 0; i < neighbours.size(); i++){
+				Index c = center + neighbours[i];
+				if (!in_bounds(c, big_extent))
+					continue;
+				int m = rank(maxVertex(c));
+				if (m == r || m == r + 1)
+					block[cellDim(c)].push_back(cell_id(c));
+			}
+		}
+
+		for (int k = 0; k <= dim; k++){
+			vector<int> &ids = block[k];
+			if (ids.size() < 2)
+				continue;
+			sort(ids.begin(), ids.end());
+			ids.erase(unique(ids.begin(), ids.end()), ids.end());
+
+			int start = INT_MAX;
+			vector< pair<long long, int> > target;
+			for (size_t i = 0; i < ids.size(); i++){
+				start = min(start, pos[k][ids[i]]);
+				target.push_back(make_pair(cellKey(cell_coord[k][ids[i]]), ids[i]));
+			}
+			sort(target.begin(), target.end());
+
+			// insertion sort by adjacent transpositions
+			for (size_t t = 0; t < target.size(); t++){
+				int p = pos[k][target[t].second];
+				MY_ASSERT(p - start < (int)ids.size());
+				for (; p > start + (int)t; p--)
+					transpose(k, p - 1);
+			}
+		}
+	}
+
+	// --- transpositions ---
+
+	// swaps the k-cells at positions i and i+1
+	void transpose(int k, int i)
+	{
+		int a = cell_at[k][i], b = cell_at[k][i+1];
+		last_transpositions++;
+
+		if (k >= 1)
+			transposeColumns(k, a, b);
+
+		pos[k][a] = i + 1;
+		pos[k][b] = i;
+		cell_at[k][i] = b;
+		cell_at[k][i+1] = a;
+
+		if (k < dim)
+			transposeRows(k + 1, a, b);
+	}
+
+	// R_k and V_k, a is the column before b
+	void transposeColumns(int k, int a, int b)
+	{
+		bool neg_a = low[k][a] >= 0, neg_b = low[k][b] >= 0;
+		if (!contains(V[k][b], a))
+			return;	// the swap keeps V upper triangular and the lows distinct
+
+		MergeArena<MatrixListType> &arena = MergeArena<MatrixListType>::local();
+		if (!neg_a){
+			// R[a] = 0: clearing V[a, b] does not change R[b]
+			list_sym_diff_inplace(V[k][b], V[k][a], arena.scratch);
+		}else if (neg_b){
+			// both negative
+			addColumn(k, a, b);
+			if (pos[k-1][low[k][a]] > pos[k-1][low[k][b]]){
+				// after the swap b comes first and a takes the other low: the deaths switch
+				addColumn(k, b, a);
+				swap(vine[k][a], vine[k][b]);
+				last_switches++;
+			}
+			setLow(k, a);
+			setLow(k, b);
+		}else{
+			// a negative, b positive: b takes over the death of a
+			MatrixListType va = V[k][a];
+			V[k][a] = V[k][b];
+			list_sym_diff_inplace(V[k][b], va, arena.scratch);
+			R[k][b].swap(R[k][a]);
+			low[k][b] = low[k][a];
+			low[k][a] = -1;
+			pivot[k][low[k][b]] = b;
+			vine[k][b] = vine[k][a];
+			vine[k][a] = -1;
+			last_switches++;
+		}
+	}
+
+	// R_j with j = k+1, whose rows a and b (k-cells) were just swapped: b is now before a
+	void transposeRows(int j, int a, int b)
+	{
+		int ca = pivot[j][a], cb = pivot[j][b];
+		if (cb < 0 || !contains(R[j][cb], a))
+			return;	// no low moves
+
+		if (ca < 0){
+			low[j][cb] = a;
+			pivot[j][a] = cb;
+			pivot[j][b] = -1;
+		}else if (pos[j][ca] < pos[j][cb]){
+			addColumn(j, ca, cb);
+			setLow(j, cb);
+		}else{
+			// the births switch, each death keeps its vine
+			addColumn(j, cb, ca);
+			low[j][ca] = b;
+			low[j][cb] = a;
+			pivot[j][a] = cb;
+			pivot[j][b] = ca;
+			last_switches++;
+		}
+	}
+
+	// column x is added to column y, in R and V
+	void addColumn(int k, int x, int y)
+	{
+		MergeArena<MatrixListType> &arena = MergeArena<MatrixListType>::local();
+		list_sym_diff_inplace(R[k][y], R[k][x], arena.scratch);
+		list_sym_diff_inplace(V[k][y], V[k][x], arena.scratch);
+	}
+
+	// recomputes the low of column c of R_k from the current order of the rows
+	void setLow(int k, int c)
+	{
+		int best = -1;
+		for (size_t i = 0; i < R[k][c].size(); i++)
+			if (best < 0 || pos[k-1][R[k][c][i]] > pos[k-1][best])
+				best = R[k][c][i];
+		MY_ASSERT(best >= 0);
+		low[k][c] = best;
+		pivot[k][best] = c;
+	}
+
+	static bool contains(const MatrixListType &l, int x)
+	{
+		return binary_search(l.begin(), l.end(), x);
+	}
+
+	// --- cells ---
+
+	static int cellDim(const Index &c)
+	{
+		int d = 0;
+		for (int i = 0; i < dim; i++)
+			d += c[i] & 1;
+		return d;
+	}
+
+	Vertex maxVertex(const Index &c) const
+	{
+		int odd[dim], nodd = 0;
+		for (int i = 0; i < dim; i++)
+			if (c[i] & 1)
+				odd[nodd++] = i;
+		Vertex best = c / 2;
+		int best_rank = -1;
+		for (int m = 0; m < (1 << nodd); m++){
+			Vertex w = c / 2;
+			for (int j = 0; j < nodd; j++)
+				if ((m >> j) & 1)
+					w[odd[j]] += 1;
+			if (rank(w) > best_rank){
+				best_rank = rank(w);
+				best = w;
+			}
+		}
+		return best;
+	}
+
+	// the position the filtration gives a cell: by its maximal vertex, then in the
+	// order in which the cells around that vertex are numbered
+	long long cellKey(const Index &c) const
+	{
+		Vertex m = maxVertex(c);
+		return (long long)rank(m) * neighbours.size() + delta_order[deltaCode(c - 2 * m)];
+	}
+
+	static int deltaCode(const Index &delta)
+	{
+		int code = 0;
+		for (int i = 0; i < dim; i++)
+			code = 3 * code + delta[i] + 1;
+		return code;
+	}
+
+	int linear(const Index &c) const
+	{
+		int l = 0;
+		for (int i = 0; i < dim; i++)
+			l = l * cell_id.extent(i) + c[i];
+		return l;
+	}
+
+	blitz::Array<double, dim> f;		// the current values
+	vector<Vertex> vList;				// vertices by rank
+	blitz::Array<int, dim> rank;
+	blitz::Array<int, dim> cell_id;		// id of every cell, on the doubled grid
+
+	vector<Index> cell_coord[dim+1];
+	vector<int> pos[dim+1], cell_at[dim+1];
+
+	vector<MatrixListType> R[dim+1], V[dim+1];	// by column id, entries are ids
+	vector<int> low[dim+1];		// low row of a column of R_k, -1 for zero columns
+	vector<int> pivot[dim+1];	// column of R_k with the given low, -1 if none
+	vector<int> vine[dim+1];	// vine id of a death column of R_k
+
+	vector<Index> neighbours;
+	vector<int> delta_order;
+	int next_vine;
+
+	long long last_swaps, last_transpositions, last_switches;
+	bool last_recomputed;
+};
+
+// Owns the vineyard of one image, whatever its dimension.
+class PersistenceVineyard
+{
+public:
+	PersistenceVineyard(const std::vector<double> &f, const std::vector<int> &dims)
+		: vines(NULL)
+	{
+		size_t n = 1;
+		for (size_t i = 0; i < dims.size(); i++){
+			if (dims[i] < 1)
+				throw std::runtime_error("Vineyard: dims must be positive");
+			n *= dims[i];
+		}
+		if (f.size() != n)
+			throw std::runtime_error("Vineyard: " + std::to_string(f.size()) + " values for an image of "
+				+ std::to_string(n));
+
+		switch(dims.size())
+		{
+		case 1:
+			vines = create<1>(f, dims);
+			break;
+		case 2:
+			vines = create<2>(f, dims);
+			break;
+		case 3:
+			vines = create<3>(f, dims);
+			break;
+		default:
+			throw std::runtime_error("Vineyard: images of 1 to 3 dimensions only, got "
+				+ std::to_string(dims.size()));
+		}
+	}
+
+	~PersistenceVineyard()
+	{
+		delete vines;
+	}
+
+	// recompute when more vertices than max_swaps swap (max_swaps < 0: half the vertices)
+	void update(const std::vector<double> &f, long long max_swaps)
+	{
+		vines->update(f, max_swaps);
+	}
+
+	std::vector<std::vector< double > > pairs(double pers_thd) const
+	{
+		return vines->rows(pers_thd);
+	}
+
+	long long lastSwaps() const { return vines->lastSwaps(); }
+	long long lastTranspositions() const { return vines->lastTranspositions(); }
+	long long lastSwitches() const { return vines->lastSwitches(); }
+	bool lastRecomputed() const { return vines->lastRecomputed(); }
+
+private:
+	PersistenceVineyard(const PersistenceVineyard &);
+	PersistenceVineyard &operator=(const PersistenceVineyard &);
+
+	template<int dim>
+	static VineyardBase *create(const std::vector<double> &f, const std::vector<int> &dims)
+	{
+		blitz::Array<double, dim> phi;
+		PythonDataReader<dim, double> reader;
+		reader.read(string(), phi, dims, f);
+		return new Vineyard<dim>(phi);
+	}
+
+	VineyardBase *vines;
+};
+
+#endif
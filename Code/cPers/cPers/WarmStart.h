@@ -0,0 +1,218 @@
+#ifndef INCLUDED_WARM_START_H
+#define INCLUDED_WARM_START_H
+
+// Persistence of images that change only a little between calls, e.g. the likelihood map
+// of one training image over the epochs. For every image id the previous vertex order, its
+// cell numbering, the pivots of its reduced matrices and (optionally) the reduced columns
+// are kept, and the next call
+//  - only reads the new values of the pairs, if the previous order is still sorted:
+//    the filtration is then combinatorially the same and so are the pairs;
+//  - otherwise re-sorts the previous order by merging its ascending runs, which is close
+//    to linear when few vertices moved, numbers again only the cells touching a vertex
+//    after the first one that moved, and takes over the reduced columns of the others;
+//  - falls back to a fresh computation when the order changed a lot.
+
+#include <map>
+
+#include "PersistenceCalcRunner.h"
+
+// A fresh sort is used once the previous order breaks into more runs than n / kWarmStartMaxRunsRatio.
+const int kWarmStartMaxRunsRatio = 16;
+
+struct WarmStartEntry
+{
+	virtual ~WarmStartEntry() {}
+};
+
+template<int dim>
+struct WarmStartState : public WarmStartEntry
+{
+	typedef blitz::TinyVector<int, dim> Vertex;
+	typedef PersPairList<Vertex> PersResultContainer;
+
+	vector<Vertex> vList;
+	Vertex extent;
+	unsigned hom_dim_mask;
+	// the pivots (and reduced columns) of the last computation
+	WarmReduction reduction;
+	// its cell numbering and birth lists, for the next computation to renumber
+	PersistenceWorkspace<dim> numbering;
+	// whether the pivots are those of vList, i.e. the last computation went through
+	bool complete;
+
+	WarmStartState() : hom_dim_mask(0), complete(false) {}
+
+	// 'reused' is set to the number of leading vertices whose order was reused
+	std::vector<std::vector< double > > compute(blitz::Array<double, dim> &phi, double pers_thd,
+		const InputFileInfo &info, bool keep_reduction, int &reused)
+	{
+		const size_t n = phi.size();
+		bool warm = complete && vList.size() == n && all(extent == phi.extent()) && hom_dim_mask == info.hom_dim_mask;
+		reused = 0;
+
+		if (warm){
+			vector<size_t> runs;
+			findRuns(phi, runs);
+			if (runs.size() == 2){
+				// same order, same pairs; those of persistence 0 at one vertex were not kept,
+				// so a negative threshold reduces again, from the reused columns
+				reused = n;
+				if (pers_thd >= 0)
+					return pairRows(phi, pers_thd);
+			}else if (runs.size() - 1 > n / kWarmStartMaxRunsRatio){
+				warm = false;
+			}else{
+				vector<Vertex> previous(vList);
+				mergeRuns(phi, runs);
+				while (reused < (int)n && all(vList[reused] == previous[reused]))
+					reused++;
+			}
+		}
+
+		if (!warm){
+			vList.clear();
+			myclear(reduction.reduced);
+		}
+		reduction.prefix_vertices = reused;
+		reduction.keep = keep_reduction;
+		extent = phi.extent();
+		hom_dim_mask = info.hom_dim_mask;
+
+		complete = false;
+		reduction.pivots.clear();
+		PersistenceCalculator<dim> calc;
+		vector<PersResultContainer> pairs(dim);
+		calc.calcPersistence(&phi, pers_thd, pairs, vList, info, &reduction, &numbering);
+		if (!keep_reduction)
+			myclear(reduction.reduced);
+		// only the numbering is needed next time
+		numbering.columns.clear();
+		for (size_t k = 0; k < numbering.low_arrays.size(); k++)
+			myclear(numbering.low_arrays[k]);
+		vector<bool>().swap(numbering.will_be_cleared);
+		complete = reduction.pivots.size() == dim;
+
+		return PersistenceCalcRunner<dim>::toRows(pairs, pers_thd);
+	}
+
+private:
+	// starts of the ascending runs of vList under phi, followed by n
+	void findRuns(const blitz::Array<double, dim> &phi, vector<size_t> &runs) const
+	{
+		runs.assign(1, 0);
+		for (size_t i = 1; i < vList.size(); i++)
+			if (phi(vList[i]) < phi(vList[i-1]))
+				runs.push_back(i);
+		runs.push_back(vList.size());
+	}
+
+	// merges neighbouring runs until one is left; equal values keep their previous order
+	void mergeRuns(const blitz::Array<double, dim> &phi, vector<size_t> runs)
+	{
+		struct Less
+		{
+			const blitz::Array<double, dim> &phi;
+			bool operator()(const Vertex &a, const Vertex &b) const { return phi(a) < phi(b); }
+		} less = {phi};
+		vector<Vertex> merged(vList.size());
+		while (runs.size() > 2){
+			vector<size_t> next;
+			for (size_t r = 0; r + 1 < runs.size(); r += 2){
+				size_t a = runs[r], m = runs[r+1];
+				size_t e = (r + 2 < runs.size()) ? runs[r+2] : m;
+				merge(vList.begin() + a, vList.begin() + m, vList.begin() + m, vList.begin() + e, merged.begin() + a, less);
+				next.push_back(a);
+			}
+			next.push_back(vList.size());
+			vList.swap(merged);
+			runs.swap(next);
+		}
+	}
+
+	// the pairs of the pivots with the values of 'phi', as toRows lists them
+	std::vector<std::vector< double > > pairRows(const blitz::Array<double, dim> &phi, double pers_thd) const
+	{
+		std::vector<std::vector< double > > rows;
+		for (int k = 0; k < dim; k++)
+			for (size_t i = 0; i < reduction.pivots[k].size(); i++){
+				const Vertex &b = vList[reduction.pivots[k][i].first], &e = vList[reduction.pivots[k][i].second];
+				double birth = phi(b), death = phi(e);
+				if (death - birth <= pers_thd)
+					continue;
+				std::vector<double> row(2*dim + 4);
+				row[0] = k;
+				row[1] = birth;
+				row[2] = death;
+				row[3] = death - birth;
+				for (int c = 0; c < dim; c++){
+					row[4+c] = b[c];
+					row[4+dim+c] = e[c];
+				}
+				rows.push_back(row);
+			}
+		return rows;
+	}
+};
+
+// The states of all images, by id. Not thread-safe: one handle per thread.
+class PersistenceWarmStart
+{
+public:
+	explicit PersistenceWarmStart(bool keep_reduction = true)
+		: keep_reduction(keep_reduction), last_reused(0)
+	{}
+
+	~PersistenceWarmStart()
+	{
+		clear();
+	}
+
+	template<int dim>
+	std::vector<std::vector< double > > compute(long long id, blitz::Array<double, dim> &phi, double pers_thd, const InputFileInfo &info)
+	{
+		WarmStartEntry *&entry = states[id];
+		WarmStartState<dim> *state = dynamic_cast<WarmStartState<dim> *>(entry);
+		if (!state){
+			delete entry;
+			entry = state = new WarmStartState<dim>();
+		}
+		return state->compute(phi, pers_thd, info, keep_reduction, last_reused);
+	}
+
+	void forget(long long id)
+	{
+		std::map<long long, WarmStartEntry *>::iterator it = states.find(id);
+		if (it == states.end())
+			return;
+		delete it->second;
+		states.erase(it);
+	}
+
+	void clear()
+	{
+		for (std::map<long long, WarmStartEntry *>::iterator it = states.begin(); it != states.end(); ++it)
+			delete it->second;
+		states.clear();
+	}
+
+	size_t size() const
+	{
+		return states.size();
+	}
+
+	// vertices whose order was taken over by the last call (all of them if only the values changed)
+	int lastReused() const
+	{
+		return last_reused;
+	}
+
+private:
+	PersistenceWarmStart(const PersistenceWarmStart &);
+	PersistenceWarmStart &operator=(const PersistenceWarmStart &);
+
+	bool keep_reduction;
+	int last_reused;
+	std::map<long long, WarmStartEntry *> states;
+};
+
+#endif